@@ -1,6 +1,240 @@
 const { MemoryStore } = require('./build/Release/memorystore.node');
 
+// Binary protocol shared with the addon; see src/wire_protocol.h for the record layout
+const OP = { GET: 1, SET: 2, DELETE: 3, INCR: 4, EXPIRE: 5 };
+const OP_CODES = { get: OP.GET, set: OP.SET, delete: OP.DELETE, incr: OP.INCR, expire: OP.EXPIRE };
+const TYPE = { WRAP: 0, INTEGER: 1, REAL: 2, BYTES: 3, STRING: 4, MISSING: 5, OK: 6, OPAQUE: 7, ERROR: 8 };
+const BINARY_KEY = 1;
+const REQUEST_HEADER_SIZE = 16;
+const RESPONSE_HEADER_SIZE = 8;
+// Command ring header fields, as indexes into an Int32Array
+const RING = { REQUEST_HEAD: 0, REQUEST_TAIL: 1, RESPONSE_HEAD: 2, RESPONSE_TAIL: 3,
+    REQUEST_CAPACITY: 4, RESPONSE_CAPACITY: 5, DOORBELL: 6, CLOSED: 7 };
+const RING_HEADER_SIZE = 32;
+const RING_MIN_CAPACITY = 256;
+// Waits for responses are cut into slices this long, to notice a ring closed meanwhile
+const RING_CLOSED_CHECK_MS = 100;
+
+const align = (size) => (size + 7) & ~7;
+// Strings up to this long are measured and copied in JS when they are ASCII, which beats a
+// native call for the short keys pipelines usually carry
+const SHORT_STRING = 32;
+
+// Views of a command ring, made once per ring
+const ringViews = new WeakMap();
+
+function viewsOf(ring) {
+    let views = ringViews.get(ring);
+    if (!views) {
+        views = { header: new Int32Array(ring, 0, RING_HEADER_SIZE / 4), bytes: Buffer.from(ring), view: new DataView(ring) };
+        ringViews.set(ring, views);
+    }
+    return views;
+}
+
+function utf8Length(string) {
+    if (string.length > SHORT_STRING) {
+        return Buffer.byteLength(string);
+    }
+    for (let i = 0; i < string.length; i++) {
+        if (string.charCodeAt(i) > 0x7f) {
+            return Buffer.byteLength(string);
+        }
+    }
+    return string.length;
+}
+
+function writeData(bytes, offset, data, length) {
+    if (typeof data !== 'string') {
+        bytes.set(new Uint8Array(data.buffer, data.byteOffset, length), offset);
+    } else if (length === data.length && length <= SHORT_STRING) {
+        for (let i = 0; i < length; i++) {
+            bytes[offset + i] = data.charCodeAt(i);
+        }
+    } else {
+        bytes.write(data, offset, length, 'utf8');
+    }
+}
+
+// The request being encoded; reused, since requests are written as soon as they're described
+const request = { op: 0, flags: 0, key: null, keyLength: 0, type: 0, value: undefined, valueLength: 0, ttlMs: 0, size: 0 };
+
+// Fills in request for an operation, working out its encodings and size
+function describeRequest(op, key, value, ttlMs) {
+    request.op = op;
+    request.key = key;
+    request.value = value;
+    request.ttlMs = ttlMs;
+    if (typeof key === 'string') {
+        request.flags = 0;
+        request.keyLength = utf8Length(key);
+    } else if (ArrayBuffer.isView(key)) {
+        request.flags = BINARY_KEY;
+        request.keyLength = key.byteLength;
+    } else {
+        throw new TypeError('Only string and binary keys can be pipelined');
+    }
+
+    if (value === undefined) {
+        request.type = 0;
+        request.valueLength = 0;
+    } else if (typeof value === 'number') {
+        request.type = Number.isSafeInteger(value) && !Object.is(value, -0) ? TYPE.INTEGER : TYPE.REAL;
+        request.valueLength = 8;
+    } else if (typeof value === 'string') {
+        request.type = TYPE.STRING;
+        request.valueLength = utf8Length(value);
+    } else if (ArrayBuffer.isView(value)) {
+        request.type = TYPE.BYTES;
+        request.valueLength = value.byteLength;
+    } else {
+        throw new TypeError('Only numbers, strings and binary values can be pipelined');
+    }
+
+    request.size = align(REQUEST_HEADER_SIZE + request.keyLength + request.valueLength);
+    return request;
+}
+
+// Writes a described request at offset of bytes, which view covers from the same start
+function writeRequest(bytes, view, offset, request) {
+    view.setUint32(offset, request.op | (request.flags << 8) | (request.type << 16), true);
+    view.setUint32(offset + 4, request.keyLength, true);
+    view.setUint32(offset + 8, request.valueLength, true);
+    view.setUint32(offset + 12, request.ttlMs, true);
+
+    let at = offset + REQUEST_HEADER_SIZE;
+    writeData(bytes, at, request.key, request.keyLength);
+    at += request.keyLength;
+    if (request.type === TYPE.INTEGER) {
+        const high = Math.floor(request.value / 0x100000000);
+        view.setUint32(at, request.value - high * 0x100000000, true);
+        view.setInt32(at + 4, high, true);
+    } else if (request.type === TYPE.REAL) {
+        view.setFloat64(at, request.value, true);
+    } else if (request.type !== 0) {
+        writeData(bytes, at, request.value, request.valueLength);
+    }
+    for (let i = at + request.valueLength; i < offset + request.size; i++) {
+        bytes[i] = 0;
+    }
+}
+
+// A batch operation's request, as { op, key, value, delta, maxAgeMs }
+function describeOperation(operation) {
+    const op = OP_CODES[operation.op];
+    if (op === undefined) {
+        throw new TypeError(`Unknown batch operation: ${operation.op}`);
+    }
+    const value = op === OP.SET ? operation.value : op === OP.INCR ? operation.delta : undefined;
+    return describeRequest(op, operation.key, value, operation.maxAgeMs || 0);
+}
+
+// The result of the response at offset of bytes to a request with the given op
+function readResponse(bytes, view, offset, op) {
+    const length = view.getUint32(offset + 4, true);
+    const payload = offset + RESPONSE_HEADER_SIZE;
+    switch (bytes[offset]) {
+        case TYPE.INTEGER:
+            return view.getUint32(payload, true) + view.getInt32(payload + 4, true) * 0x100000000;
+        case TYPE.REAL:
+            return view.getFloat64(payload, true);
+        case TYPE.BYTES:
+            return Buffer.from(bytes.subarray(payload, payload + length));
+        case TYPE.STRING:
+            return bytes.toString('utf8', payload, payload + length);
+        case TYPE.MISSING:
+            return op === OP.GET ? undefined : false;
+        case TYPE.OK:
+            return true;
+        case TYPE.OPAQUE:
+            return MemoryStoreWrapper.OPAQUE;
+        default:
+            return new Error(bytes.toString('utf8', payload, payload + length));
+    }
+}
+
 class MemoryStoreWrapper {
+    /**
+     * Pick the shard that owns a key, for spreading keys over stores owned by separate
+     * worker threads. Stable across threads and processes, and changing the shard count
+     * moves as few keys as possible
+     * @param {string|Buffer|TypedArray} key - The key to place
+     * @param {number} shards - Number of shards, an integer from 1 to 2^32 - 1
+     * @returns {number} - Shard index, from 0 to shards - 1
+     */
+    static shardOf(key, shards) {
+        return MemoryStore.shardOf(key, shards);
+    }
+
+    /**
+     * Start worker threads that each own one shard of the keys, in a store of their own.
+     * Other threads reach them through command rings, so no store is ever shared
+     * @param {number} shards - Number of shards, and so of worker threads
+     * @param {Object} options - Options for each shard's store; must survive postMessage,
+     * so loaders are not supported
+     * @returns {ShardPool} - The shard owners
+     */
+    static createShards(shards, options = {}) {
+        return new ShardPool(shards, options);
+    }
+
+    /**
+     * Create a command ring: a SharedArrayBuffer through which a RingClient, on this or
+     * another thread, pipelines operations to a store
+     * @param {Object} options - Ring options
+     * @param {number} options.requestBytes - Space for requests waiting to be served (default: 64 KiB)
+     * @param {number} options.responseBytes - Space for responses waiting to be read (default: 256 KiB)
+     * @returns {SharedArrayBuffer} - The ring, to hand to serveRing() or drainRing() and to a RingClient
+     */
+    static createRing(options = {}) {
+        const requestBytes = Math.max(RING_MIN_CAPACITY, align(options.requestBytes || 64 * 1024));
+        const responseBytes = Math.max(RING_MIN_CAPACITY, align(options.responseBytes || 256 * 1024));
+        const ring = new SharedArrayBuffer(RING_HEADER_SIZE + requestBytes + responseBytes);
+        const header = new Int32Array(ring, 0, RING_HEADER_SIZE / 4);
+        header[RING.REQUEST_CAPACITY] = requestBytes;
+        header[RING.RESPONSE_CAPACITY] = responseBytes;
+        return ring;
+    }
+
+    /**
+     * Encode operations for executeBatch()
+     * @param {Array<{op: string, key: string|Buffer|TypedArray, value: any, delta: number, maxAgeMs: number}>} ops - Operations:
+     * get, set (with value), delete, incr (with an optional delta) and expire
+     * @returns {Buffer} - The encoded batch
+     */
+    static encodeBatch(ops) {
+        let length = 0;
+        for (const operation of ops) {
+            length += describeOperation(operation).size;
+        }
+        const batch = Buffer.alloc(length);
+        const view = new DataView(batch.buffer, batch.byteOffset, batch.byteLength);
+        let offset = 0;
+        for (const operation of ops) {
+            const request = describeOperation(operation);
+            writeRequest(batch, view, offset, request);
+            offset += request.size;
+        }
+        return batch;
+    }
+
+    /**
+     * Decode executeBatch()'s results
+     * @param {Buffer} results - What executeBatch() returned
+     * @param {Array<{op: string}>} ops - The operations that were encoded, to tell what a missing key means for each
+     * @returns {Array} - Each operation's result, as a RingClient would report it
+     */
+    static decodeBatch(results, ops) {
+        const view = new DataView(results.buffer, results.byteOffset, results.byteLength);
+        const decoded = new Array(ops.length);
+        let offset = 0;
+        for (let i = 0; i < ops.length; i++) {
+            decoded[i] = readResponse(results, view, offset, OP_CODES[ops[i].op]);
+            offset += align(RESPONSE_HEADER_SIZE + view.getUint32(offset + 4, true));
+        }
+        return decoded;
+    }
+
     constructor(options = {}) {
         this._store = new MemoryStore(options);
 
@@ -28,26 +262,195 @@ class MemoryStoreWrapper {
         return this._store.createMutableKey(initialValue);
     }
 
+    /**
+     * Resolve and hash a key once, returning an opaque handle for hot lookups
+     * @param {string|Proxy} key - The key to precompile (mutable keys are captured at their current id)
+     * @returns {object} - A handle accepted anywhere a key is, skipping conversion and hashing
+     */
+    handle(key) {
+        return this._store.handle(key);
+    }
+
     /**
      * Store a value in memory
      * @param {string|Proxy} key - The key to store the value under (can be a string or mutable key)
      * @param {any} value - The value to store (can be any JavaScript value)
      * @param {Object} options - Storage options
-     * @param {boolean} options.isPermanent - If true, item never expires (default: true)
+     * @param {boolean} options.isPermanent - If true, item never expires (default: true, or false in a namespace with defaultMaxAgeMs)
      * @param {number} options.maxAgeMs - Time in ms before item expires (only if isPermanent is false)
+     * @param {number} options.size - Bytes to count the value as against byte quotas (estimated by default)
+     * @param {number} options.staleAfterMs - Time in ms after which reads still return the item but reload it in the background
+     * @param {number} options.refreshAheadMs - Treat the item as stale this long before it expires
+     * @param {number} options.ttlJitter - Randomly shorten maxAgeMs by up to this fraction (0-1)
+     * @param {number} options.earlyExpiryBeta - Probabilistic early expiration (XFetch) eagerness; 0 disables it
+     * @param {number} options.computeMs - How long the value took to load, for earlyExpiryBeta
      * @returns {boolean} - Success status
      */
-    set(key, value, options = { isPermanent: true }) {
+    set(key, value, options = {}) {
         return this._store.set(key, value, options);
     }
 
     /**
     * Retrieve a value from memory
     * @param {string|Proxy} key - The key to retrieve
+    * @param {any} missingValue - Returned instead of undefined if the key is known to be missing
     * @returns {any} - The stored value or undefined if not found or expired
     */
-    get(key) {
-        return this._store.get(key);
+    get(key, missingValue) {
+        return this._store.get(key, missingValue);
+    }
+
+    /**
+     * Replace a value with fn's result, looking the key up once. fn must be synchronous;
+     * if it throws, the stored value is left as it was
+     * @param {string|Proxy} key - The key to update
+     * @param {function(any): any} fn - Called with the current value (undefined if missing); returning undefined deletes the key
+     * @param {Object} options - Storage options, as for set(); without them an existing item keeps its lifetime
+     * @returns {any} - The new value
+     */
+    update(key, fn, options) {
+        return this._store.update(key, fn, options);
+    }
+
+    /**
+     * Retrieve a value together with its version, for setIfVersion() and deleteIfVersion()
+     * @param {string|Proxy} key - The key to retrieve
+     * @returns {{value: any, version: number}|undefined} - undefined if not found or expired
+     */
+    getWithVersion(key) {
+        return this._store.getWithVersion(key);
+    }
+
+    /**
+     * Retrieve a value only if it changed since the caller's copy, ETag style
+     * @param {string|Proxy} key - The key to retrieve
+     * @param {number} knownVersion - Version of the caller's copy, from getWithVersion() or an earlier getIfChanged()
+     * @param {any} unchangedValue - Returned if the key is still at knownVersion (default: MemoryStore.UNCHANGED)
+     * @returns {{value: any, version: number}|any|undefined} - The value and its new version, unchangedValue, or undefined if not found or expired
+     */
+    getIfChanged(key, knownVersion, unchangedValue = MemoryStoreWrapper.UNCHANGED) {
+        return this._store.getIfChanged(key, knownVersion, unchangedValue);
+    }
+
+    /**
+     * Store a value only if the key is still at the expected version (compare-and-set)
+     * @param {string|Proxy} key - The key to store the value under
+     * @param {any} value - The value to store
+     * @param {number} expectedVersion - Version from getWithVersion(), or 0 to only store if the key is missing
+     * @param {Object} options - Storage options, as for set()
+     * @returns {number|false} - The new version, or false if the key was changed meanwhile
+     */
+    setIfVersion(key, value, expectedVersion, options = {}) {
+        return this._store.setIfVersion(key, value, expectedVersion, options);
+    }
+
+    /**
+     * Delete a value only if the key is still at the expected version
+     * @param {string|Proxy} key - The key to delete
+     * @param {number} expectedVersion - Version from getWithVersion()
+     * @returns {boolean} - True if the key was deleted
+     */
+    deleteIfVersion(key, expectedVersion) {
+        return this._store.deleteIfVersion(key, expectedVersion);
+    }
+
+    /**
+     * Apply several writes atomically: all of them, or none if a version check fails
+     * @param {Array<Object>} ops - Operations, each {op, key, ...}: {op: 'set', value, options}, {op: 'delete'},
+     *   {op: 'incr'|'decr', delta, initial, options}, {op: 'setIfVersion', value, version, options}, {op: 'deleteIfVersion', version}
+     * @returns {Array<any>|false} - Each operation's result, as its standalone method would return it, or false if nothing was applied
+     */
+    transaction(ops) {
+        return this._store.transaction(ops);
+    }
+
+    /**
+     * Atomically add to an integer counter, creating it if missing
+     * @param {string|Proxy} key - The counter's key
+     * @param {number} delta - Integer to add (default: 1)
+     * @param {Object} options - Storage options for a new counter, as for set(), except that maxAgeMs alone makes it
+     * expire; an existing counter keeps its lifetime
+     * @param {number} options.initial - Value a new counter starts from before delta is added (default: 0)
+     * @returns {number} - The new value; throws if the stored value isn't an integer
+     */
+    incr(key, delta = 1, options = {}) {
+        return this._store.incr(key, delta, options);
+    }
+
+    /**
+     * Atomically subtract from an integer counter, creating it if missing
+     * @param {string|Proxy} key - The counter's key
+     * @param {number} delta - Integer to subtract (default: 1)
+     * @param {Object} options - Storage options for a new counter, as for incr()
+     * @returns {number} - The new value
+     */
+    decr(key, delta = 1, options = {}) {
+        return this._store.decr(key, delta, options);
+    }
+
+    /**
+     * Atomically add a possibly fractional amount to a number, creating it if missing
+     * @param {string|Proxy} key - The number's key
+     * @param {number} delta - Amount to add
+     * @param {Object} options - Storage options for a new number, as for incr()
+     * @returns {number} - The new value; throws if the stored value isn't a number
+     */
+    incrByFloat(key, delta, options = {}) {
+        return this._store.incrByFloat(key, delta, options);
+    }
+
+    /**
+     * Get a value, loading it on a miss. Concurrent misses for the same key share a single
+     * call to the loader and all wait for its result
+     * @param {string|Proxy} key - The key to retrieve
+     * @param {function(any): any|Promise<any>} loader - Called with the key on a miss; its result is stored unless undefined
+     * @param {Object} options - Storage options for the loaded value, as for set()
+     * @returns {Promise<any>} - The stored or loaded value; rejects if the loader throws or rejects
+     */
+    getOrLoad(key, loader, options = {}) {
+        return this._store.getOrLoad(key, loader, options);
+    }
+
+    /**
+     * Get a value through the registered batchLoader. Misses from the same tick are loaded
+     * together in one batchLoader call
+     * @param {string|Proxy} key - The key to retrieve
+     * @param {Object} options - Storage options for the loaded value, as for set()
+     * @returns {Promise<any>} - The stored or loaded value
+     */
+    load(key, options = {}) {
+        return this._store.load(key, options);
+    }
+
+    /**
+     * Get several values through the registered batchLoader
+     * @param {Array<string|Proxy>} keys - The keys to retrieve
+     * @param {Object} options - Storage options for the loaded values, as for set()
+     * @returns {Promise<Array<any>>} - The values, in the order of keys
+     */
+    loadMany(keys, options = {}) {
+        return this._store.loadMany(keys, options);
+    }
+
+    /**
+     * Retrieve several values under a single lock
+     * @param {Array<string|Proxy>} keys - The keys to retrieve
+     * @param {any} missingValue - Returned instead of undefined for keys known to be missing
+     * @returns {Array<any>} - The values, undefined where not found or expired
+     */
+    mget(keys, missingValue) {
+        return this._store.mget(keys, missingValue);
+    }
+
+    /**
+     * Record that a key has no value, e.g. an ID that doesn't exist at the origin. Costs much
+     * less than storing null, and replaces any value stored under the key
+     * @param {string|Proxy} key - The key that is missing
+     * @param {number} ttlMs - How long to remember it (default: negativeMaxAgeMs; 0 until set or deleted)
+     * @returns {boolean} - Success status
+     */
+    setMissing(key, ttlMs) {
+        return this._store.setMissing(key, ttlMs);
     }
     
     /**
@@ -69,7 +472,17 @@ class MemoryStoreWrapper {
     }
 
     /**
-     * Clear all stored values
+     * Delete a value now, but release its memory in a later tick
+     * @param {string|Proxy} key - The key to delete
+     * @returns {Promise<boolean>} - Resolves once released; false if the key wasn't found
+     */
+    deleteAsync(key) {
+        return this._store.deleteAsync(key);
+    }
+
+    /**
+     * Clear all stored values. The store is empty immediately; the old entries are
+     * released in small slices over the following ticks
      * @returns {boolean} - Success status
      */
     clear() {
@@ -86,7 +499,7 @@ class MemoryStoreWrapper {
 
     /**
      * Get all keys in the store as strings
-     * @returns {string[]} - Array of key strings
+     * @returns {Array<string|Buffer|Object>} - Array of key strings (Buffers for binary keys, original objects for identity/structural keys)
      */
     keys() {
         return this._store.keys();
@@ -117,6 +530,100 @@ class MemoryStoreWrapper {
         return this._store.stopCleanupTask();
     }
 
+    /**
+     * Get a namespace: an isolated keyspace sharing this store's lock, cleanup thread and settings
+     * @param {string} name - Namespace name; the same name always refers to the same keys
+     * @param {Object} options - Namespace options
+     * @param {number} options.expectedSize - Number of entries to size the namespace for up front
+     * @param {number} options.defaultMaxAgeMs - Lifetime of entries set without isPermanent or maxAgeMs
+     * @param {number} options.ttlJitter - Default ttlJitter for the namespace's entries
+     * @param {number} options.earlyExpiryBeta - Default earlyExpiryBeta for the namespace's entries
+     * @param {function(any): any|Promise<any>} options.loader - Reloads stale entries read with get()
+     * @param {function(Array<any>): Promise<Array<any>>} options.batchLoader - Loads the namespace's misses in batches
+     * @param {number} options.negativeMaxAgeMs - How long to remember keys a loader found nothing for
+     * @param {number} options.maxEntries - Quota on the namespace's entries; it evicts its own entries beyond it
+     * @param {number} options.maxBytes - Quota on the namespace's estimated bytes
+     * @returns {MemoryStoreWrapper} - A store limited to the namespace
+     */
+    namespace(name, options = {}) {
+        const view = Object.create(MemoryStoreWrapper.prototype);
+        view._store = this._store.namespace(name, options);
+        return view;
+    }
+
+    /**
+     * Get counters for this store or namespace
+     * @returns {{size: number, bytes: number, hits: number, misses: number, sets: number, deletes: number, expired: number, evicted: number, loads: number, coalesced: number, refreshes: number, earlyExpired: number, batches: number, negativeHits: number, unchanged: number, missing: number}}
+     */
+    stats() {
+        return this._store.stats();
+    }
+
+    /**
+     * Get counters for the store's lock, which its namespaces share
+     * @returns {{acquisitions: number, contended: number, parked: number, waitNs: number}}
+     */
+    lockStats() {
+        return this._store.lockStats();
+    }
+
+    /**
+     * Run a batch of binary encoded operations in one native call, under one lock
+     * @param {Buffer|TypedArray} batch - Operations, as encoded by MemoryStore.encodeBatch() or src/wire_protocol.h
+     * @returns {Buffer} - One response per operation, in order
+     */
+    executeBatch(batch) {
+        return this._store.executeBatch(batch);
+    }
+
+    /**
+     * Serve every request waiting in a command ring, in one native call, and wake the
+     * client waiting for the responses
+     * @param {SharedArrayBuffer} ring - A ring made by MemoryStore.createRing()
+     * @returns {number} - Number of requests served; fewer than were waiting if the response space filled up
+     */
+    drainRing(ring) {
+        const { header, bytes } = viewsOf(ring);
+        const served = this._store.drainRing(bytes);
+        if (served > 0) {
+            Atomics.notify(header, RING.RESPONSE_HEAD);
+        }
+        return served;
+    }
+
+    /**
+     * Serve a command ring from this thread's event loop whenever its client flushes
+     * @param {SharedArrayBuffer} ring - A ring made by MemoryStore.createRing()
+     * @returns {function(): void} - Stops serving the ring
+     */
+    serveRing(ring) {
+        const { header } = viewsOf(ring);
+        let serving = true;
+        const serve = () => {
+            if (!serving) {
+                return;
+            }
+            // Read before draining, so a flush that lands while draining isn't missed
+            const doorbell = Atomics.load(header, RING.DOORBELL);
+            this.drainRing(ring);
+            if (typeof Atomics.waitAsync !== 'function') {
+                setTimeout(serve, 1);
+                return;
+            }
+            const wait = Atomics.waitAsync(header, RING.DOORBELL, doorbell);
+            if (wait.async) {
+                wait.value.then(serve);
+            } else {
+                setImmediate(serve);
+            }
+        };
+        serve();
+        return () => {
+            serving = false;
+            Atomics.notify(header, RING.DOORBELL);
+        };
+    }
+
     /**
      * Get all values stored in the memory store
      * @returns {Array} - Array of all stored values (excluding expired items)
@@ -134,4 +641,461 @@ class MemoryStoreWrapper {
     }
 }
 
+/**
+ * Client end of a command ring. Operations are encoded straight into the ring and answered
+ * in order, by a store serving or draining it, without a native call each
+ */
+class RingClient {
+    /**
+     * @param {SharedArrayBuffer} ring - A ring made by MemoryStore.createRing()
+     */
+    constructor(ring) {
+        const { header, bytes, view } = viewsOf(ring);
+        this._header = header;
+        this._bytes = bytes;
+        this._view = view;
+        this._requestCapacity = header[RING.REQUEST_CAPACITY];
+        this._responseCapacity = header[RING.RESPONSE_CAPACITY];
+        this._responses = RING_HEADER_SIZE + this._requestCapacity;
+        // Ops of the requests whose responses haven't been read, oldest at _next
+        this._pending = [];
+        this._next = 0;
+    }
+
+    /**
+     * Queue a get; its result is the value, or undefined if the key is missing
+     * @param {string|Buffer|TypedArray} key - The key
+     */
+    get(key) {
+        this._push(OP.GET, key, undefined, 0);
+    }
+
+    /**
+     * Queue a set; its result is true
+     * @param {string|Buffer|TypedArray} key - The key
+     * @param {number|string|Buffer|TypedArray} value - The value; binary values are read back as Buffers
+     * @param {number} maxAgeMs - Lifetime in milliseconds, or 0 for the store's default
+     */
+    set(key, value, maxAgeMs = 0) {
+        this._push(OP.SET, key, value, maxAgeMs);
+    }
+
+    /**
+     * Queue a delete; its result is whether the key existed
+     * @param {string|Buffer|TypedArray} key - The key
+     */
+    delete(key) {
+        this._push(OP.DELETE, key, undefined, 0);
+    }
+
+    /**
+     * Queue an increment; its result is the new count, or an Error if the value isn't an integer
+     * or the count would leave the safe integers
+     * @param {string|Buffer|TypedArray} key - The key
+     * @param {number} delta - Integer to add
+     * @param {number} maxAgeMs - Lifetime of a counter this creates, or 0 for the store's default
+     */
+    incr(key, delta = 1, maxAgeMs = 0) {
+        if (!Number.isSafeInteger(delta)) {
+            throw new TypeError('Delta must be an integer');
+        }
+        this._push(OP.INCR, key, delta, maxAgeMs);
+    }
+
+    /**
+     * Queue a change of lifetime; its result is whether the key existed
+     * @param {string|Buffer|TypedArray} key - The key
+     * @param {number} maxAgeMs - New lifetime from now, or 0 to never expire
+     */
+    expire(key, maxAgeMs) {
+        this._push(OP.EXPIRE, key, undefined, maxAgeMs);
+    }
+
+    /**
+     * Wake the store serving the ring
+     */
+    flush() {
+        Atomics.add(this._header, RING.DOORBELL, 1);
+        Atomics.notify(this._header, RING.DOORBELL);
+    }
+
+    /**
+     * Flush and block until every queued operation is answered. Only threads that may
+     * block can call it, so not the main thread
+     * @param {number} timeoutMs - How long to wait for the store
+     * @returns {Array} - Results, in the order the operations were queued
+     */
+    read(timeoutMs = Infinity) {
+        const results = [];
+        const deadline = Date.now() + timeoutMs;
+        while (this._next < this._pending.length) {
+            const head = Atomics.load(this._header, RING.RESPONSE_HEAD);
+            this._take(results);
+            if (this._next < this._pending.length) {
+                // Reading freed response space, so a store that ran out of it has more to do
+                this.flush();
+                Atomics.wait(this._header, RING.RESPONSE_HEAD, head, this._waitSliceMs(deadline));
+            }
+        }
+        return results;
+    }
+
+    /**
+     * Flush and wait, without blocking the thread, until every queued operation is answered
+     * @param {number} timeoutMs - How long to wait for the store
+     * @returns {Promise<Array>} - Results, in the order the operations were queued
+     */
+    async readAsync(timeoutMs = Infinity) {
+        const results = [];
+        const deadline = Date.now() + timeoutMs;
+        while (this._next < this._pending.length) {
+            const head = Atomics.load(this._header, RING.RESPONSE_HEAD);
+            this._take(results);
+            if (this._next < this._pending.length) {
+                this.flush();
+                const sliceMs = this._waitSliceMs(deadline);
+                if (typeof Atomics.waitAsync !== 'function') {
+                    await new Promise((resolve) => setTimeout(resolve, Math.min(sliceMs, 1)));
+                    continue;
+                }
+                const wait = Atomics.waitAsync(this._header, RING.RESPONSE_HEAD, head, sliceMs);
+                if (wait.async) {
+                    await wait.value;
+                }
+            }
+        }
+        return results;
+    }
+
+    /**
+     * Get the results answered so far, without waiting
+     * @returns {Array} - Results, in the order the operations were queued
+     */
+    results() {
+        const results = [];
+        this._take(results);
+        return results;
+    }
+
+    // How long to wait for responses before checking again; throws once waiting is pointless
+    _waitSliceMs(deadline) {
+        if (Atomics.load(this._header, RING.CLOSED) !== 0) {
+            throw new Error('The store serving the ring has stopped');
+        }
+        const remainingMs = deadline - Date.now();
+        if (remainingMs <= 0) {
+            throw new Error('Timed out waiting for the store');
+        }
+        return Math.min(remainingMs, RING_CLOSED_CHECK_MS);
+    }
+
+    _push(op, key, value, ttlMs) {
+        const request = describeRequest(op, key, value, ttlMs);
+        const capacity = this._requestCapacity;
+        // Larger requests might never find room, however much the store serves
+        if (request.size + 8 > capacity / 2) {
+            throw new RangeError('Request is too large for the ring');
+        }
+        const tail = Atomics.load(this._header, RING.REQUEST_TAIL);
+        let head = this._header[RING.REQUEST_HEAD];
+
+        // Same rules as the store's side: never fill the ring completely, and start over at
+        // the beginning, behind a wrap marker, when the end has no room
+        if (head >= tail) {
+            const end = capacity - head;
+            if (request.size > end || (request.size === end && tail === 0)) {
+                if (request.size >= tail) {
+                    throw new RangeError('Command ring is full; read results first');
+                }
+                this._bytes[RING_HEADER_SIZE + head] = TYPE.WRAP;
+                head = 0;
+            }
+        } else if (head + request.size >= tail) {
+            throw new RangeError('Command ring is full; read results first');
+        }
+
+        writeRequest(this._bytes, this._view, RING_HEADER_SIZE + head, request);
+        this._pending.push(op);
+        Atomics.store(this._header, RING.REQUEST_HEAD, (head + request.size) % capacity);
+    }
+
+    _take(results) {
+        const head = Atomics.load(this._header, RING.RESPONSE_HEAD);
+        let tail = this._header[RING.RESPONSE_TAIL];
+        while (tail !== head) {
+            const offset = this._responses + tail;
+            if (this._bytes[offset] === TYPE.WRAP) {
+                tail = 0;
+                continue;
+            }
+            results.push(readResponse(this._bytes, this._view, offset, this._pending[this._next++]));
+            tail = (tail + align(RESPONSE_HEADER_SIZE + this._view.getUint32(offset + 4, true))) % this._responseCapacity;
+        }
+        Atomics.store(this._header, RING.RESPONSE_TAIL, tail);
+        if (this._next === this._pending.length) {
+            this._pending.length = 0;
+            this._next = 0;
+        }
+    }
+}
+
+/**
+ * Client of every shard of a ShardPool: routes each operation by its key to the ring of the
+ * shard that owns it, and hands back results in the order the operations were queued
+ */
+class ShardedClient {
+    /**
+     * @param {Array<SharedArrayBuffer>} rings - One ring per shard, from ShardPool.createRings()
+     */
+    constructor(rings) {
+        this._clients = rings.map((ring) => new RingClient(ring));
+        // Shard of each operation whose result hasn't been handed out, oldest first
+        this._order = [];
+        // Results read from each shard but not yet handed out
+        this._ready = rings.map(() => ({ results: [], next: 0 }));
+    }
+
+    /**
+     * Queue a get; its result is the value, or undefined if the key is missing
+     * @param {string|Buffer|TypedArray} key - The key
+     */
+    get(key) {
+        const shard = this._shardOf(key);
+        this._clients[shard].get(key);
+        this._order.push(shard);
+    }
+
+    /**
+     * Queue a set; its result is true
+     * @param {string|Buffer|TypedArray} key - The key
+     * @param {number|string|Buffer|TypedArray} value - The value; binary values are read back as Buffers
+     * @param {number} maxAgeMs - Lifetime in milliseconds, or 0 for the store's default
+     */
+    set(key, value, maxAgeMs = 0) {
+        const shard = this._shardOf(key);
+        this._clients[shard].set(key, value, maxAgeMs);
+        this._order.push(shard);
+    }
+
+    /**
+     * Queue a delete; its result is whether the key existed
+     * @param {string|Buffer|TypedArray} key - The key
+     */
+    delete(key) {
+        const shard = this._shardOf(key);
+        this._clients[shard].delete(key);
+        this._order.push(shard);
+    }
+
+    /**
+     * Queue an increment; its result is the new count, or an Error if the value isn't an integer
+     * or the count would leave the safe integers
+     * @param {string|Buffer|TypedArray} key - The key
+     * @param {number} delta - Integer to add
+     * @param {number} maxAgeMs - Lifetime of a counter this creates, or 0 for the store's default
+     */
+    incr(key, delta = 1, maxAgeMs = 0) {
+        const shard = this._shardOf(key);
+        this._clients[shard].incr(key, delta, maxAgeMs);
+        this._order.push(shard);
+    }
+
+    /**
+     * Queue a change of lifetime; its result is whether the key existed
+     * @param {string|Buffer|TypedArray} key - The key
+     * @param {number} maxAgeMs - New lifetime from now, or 0 to never expire
+     */
+    expire(key, maxAgeMs) {
+        const shard = this._shardOf(key);
+        this._clients[shard].expire(key, maxAgeMs);
+        this._order.push(shard);
+    }
+
+    /**
+     * Wake every shard owner
+     */
+    flush() {
+        for (const client of this._clients) {
+            client.flush();
+        }
+    }
+
+    /**
+     * Flush and block until every queued operation is answered. Only threads that may
+     * block can call it, so not the main thread
+     * @param {number} timeoutMs - How long to wait for each shard
+     * @returns {Array} - Results, in the order the operations were queued
+     */
+    read(timeoutMs = Infinity) {
+        // Every shard works on its share while this one is waited for
+        this.flush();
+        this._clients.forEach((client, shard) => this._keep(shard, client.read(timeoutMs)));
+        return this._collect();
+    }
+
+    /**
+     * Flush and wait, without blocking the thread, until every queued operation is answered
+     * @param {number} timeoutMs - How long to wait for each shard
+     * @returns {Promise<Array>} - Results, in the order the operations were queued
+     */
+    async readAsync(timeoutMs = Infinity) {
+        const answered = await Promise.all(this._clients.map((client) => client.readAsync(timeoutMs)));
+        answered.forEach((results, shard) => this._keep(shard, results));
+        return this._collect();
+    }
+
+    /**
+     * Get the results answered so far, without waiting. An answered operation waits for the
+     * ones queued before it, on other shards
+     * @returns {Array} - Results, in the order the operations were queued
+     */
+    results() {
+        this._clients.forEach((client, shard) => this._keep(shard, client.results()));
+        return this._collect();
+    }
+
+    _shardOf(key) {
+        return MemoryStore.shardOf(key, this._clients.length);
+    }
+
+    _keep(shard, results) {
+        const ready = this._ready[shard];
+        for (const result of results) {
+            ready.results.push(result);
+        }
+    }
+
+    _collect() {
+        const results = [];
+        let next = 0;
+        for (; next < this._order.length; next++) {
+            const ready = this._ready[this._order[next]];
+            if (ready.next === ready.results.length) {
+                break;
+            }
+            results.push(ready.results[ready.next++]);
+        }
+        this._order.splice(0, next);
+        for (const ready of this._ready) {
+            if (ready.next === ready.results.length) {
+                ready.results.length = 0;
+                ready.next = 0;
+            }
+        }
+        return results;
+    }
+}
+
+// Tells a ring's client that nothing serves it any more
+function closeRing(ring) {
+    const { header } = viewsOf(ring);
+    Atomics.store(header, RING.CLOSED, 1);
+    Atomics.notify(header, RING.RESPONSE_HEAD);
+}
+
+// Runs in each shard owner: one store, serving every ring it is sent
+const SHARD_OWNER = `
+const { parentPort, workerData } = require('worker_threads');
+const MemoryStore = require(workerData.module);
+const store = new MemoryStore(workerData.options);
+parentPort.on('message', (ring) => store.serveRing(ring));
+`;
+
+/**
+ * Worker threads that each own one shard of the keys. Keys are placed with shardOf(), so a
+ * client on any thread, or in another pool of the same size, agrees on every key's owner
+ */
+class ShardPool {
+    /**
+     * @param {number} shards - Number of shards, and so of worker threads
+     * @param {Object} options - Options for each shard's store
+     */
+    constructor(shards, options = {}) {
+        // More owners than cores only adds threads that take turns
+        const os = require('os');
+        const maxShards = 4 * (typeof os.availableParallelism === 'function' ? os.availableParallelism() : os.cpus().length);
+        if (!Number.isInteger(shards) || shards < 1 || shards > maxShards) {
+            throw new RangeError(`Shard count must be an integer from 1 to ${maxShards}, four per CPU`);
+        }
+        // Bad options throw here, rather than in every owner
+        new MemoryStoreWrapper({ ...options, autoStartCleanup: false });
+
+        const { Worker } = require('worker_threads');
+        this._workers = [];
+        // Rings each owner serves, and whether it has stopped
+        this._rings = [];
+        this._stopped = [];
+        for (let shard = 0; shard < shards; shard++) {
+            const worker = new Worker(SHARD_OWNER, { eval: true, workerData: { module: __filename, options } });
+            this._rings.push([]);
+            this._stopped.push(false);
+            // An owner that fails stops with it; its clients learn of it from their rings
+            worker.on('error', () => {});
+            worker.on('exit', () => {
+                this._stopped[shard] = true;
+                this._rings[shard].forEach(closeRing);
+            });
+            this._workers.push(worker);
+        }
+    }
+
+    /**
+     * Number of shards
+     */
+    get shards() {
+        return this._workers.length;
+    }
+
+    /**
+     * Create one ring per shard and have each owner serve its ring. The rings can be sent
+     * to another thread with postMessage, to make a ShardedClient there
+     * @param {Object} options - Ring sizes, as for MemoryStore.createRing()
+     * @returns {Array<SharedArrayBuffer>} - Rings, in shard order
+     */
+    createRings(options = {}) {
+        return this._workers.map((worker, shard) => {
+            const ring = MemoryStoreWrapper.createRing(options);
+            if (this._stopped[shard]) {
+                closeRing(ring);
+            } else {
+                this._rings[shard].push(ring);
+                worker.postMessage(ring);
+            }
+            return ring;
+        });
+    }
+
+    /**
+     * Create a client of every shard, for this thread
+     * @param {Object} options - Ring sizes, as for MemoryStore.createRing()
+     * @returns {ShardedClient} - The client
+     */
+    connect(options = {}) {
+        return new ShardedClient(this.createRings(options));
+    }
+
+    /**
+     * Stop every shard owner; their stores and everything in them are released, and
+     * reads still waiting for them throw
+     * @returns {Promise<void>} - Resolves once every worker has exited
+     */
+    async close() {
+        await Promise.all(this._workers.map((worker) => worker.terminate()));
+    }
+}
+
+/**
+ * Returned by getIfChanged() when the caller's copy is current
+ */
+MemoryStoreWrapper.UNCHANGED = Symbol('unchanged');
+
+/**
+ * Result of a pipelined get of a value that only exists as a JS object
+ */
+MemoryStoreWrapper.OPAQUE = Symbol('opaque');
+
+MemoryStoreWrapper.RingClient = RingClient;
+
+MemoryStoreWrapper.ShardedClient = ShardedClient;
+
 module.exports = MemoryStoreWrapper;
\ No newline at end of file
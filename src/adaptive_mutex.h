@@ -0,0 +1,107 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+// Mutex that spins briefly before parking. The critical sections it guards are a few hundred
+// nanoseconds, so a waiter that retries with a short, growing backoff usually gets the lock
+// before a trip through the kernel would even have put it to sleep. Only when spinning fails
+// does it block on the underlying std::mutex.
+//
+// It also counts how often it was taken, how often that had to wait and for how long. The
+// counters are only written by the thread that holds the lock, so they need no atomics;
+// read them through GetStats while holding it.
+//
+// Satisfies Lockable, so it works with std::lock_guard, std::unique_lock and
+// std::condition_variable_any.
+class AdaptiveMutex {
+public:
+  struct Stats {
+    uint64_t acquisitions = 0;
+    // Acquisitions that found the lock taken
+    uint64_t contended = 0;
+    // Contended acquisitions that gave up spinning and blocked
+    uint64_t parked = 0;
+    // Time spent waiting by contended acquisitions
+    uint64_t waitNs = 0;
+  };
+
+  AdaptiveMutex() = default;
+
+  AdaptiveMutex(const AdaptiveMutex&) = delete;
+  AdaptiveMutex& operator=(const AdaptiveMutex&) = delete;
+
+  void lock() {
+    if (mutex.try_lock()) {
+      stats.acquisitions++;
+      return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    bool parked = true;
+    for (uint32_t round = 0, pauses = 1; round < kSpinRounds; round++) {
+      for (uint32_t i = 0; i < pauses; i++) {
+        Pause();
+      }
+      if (mutex.try_lock()) {
+        parked = false;
+        break;
+      }
+      if (pauses < kMaxPauses) {
+        pauses *= 2;
+      }
+    }
+    if (parked) {
+      mutex.lock();
+    }
+
+    stats.acquisitions++;
+    stats.contended++;
+    stats.parked += parked;
+    stats.waitNs += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count());
+  }
+
+  bool try_lock() {
+    if (!mutex.try_lock()) {
+      return false;
+    }
+    stats.acquisitions++;
+    return true;
+  }
+
+  void unlock() {
+    mutex.unlock();
+  }
+
+  // Must be called with the lock held
+  Stats GetStats() const {
+    return stats;
+  }
+
+private:
+  // About 1000 pauses in total, a few microseconds on current hardware
+  static constexpr uint32_t kSpinRounds = 20;
+  static constexpr uint32_t kMaxPauses = 64;
+
+  static void Pause() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#else
+    std::this_thread::yield();
+#endif
+  }
+
+  std::mutex mutex;
+  Stats stats;
+};
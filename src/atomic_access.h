@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+
+// Atomic loads and stores of plain fields (pointers and integers up to pointer size),
+// for data that is shared between threads only on a few paths. Making such fields
+// std::atomic would turn every access on the single-threaded paths into an atomic one.
+//
+// GCC and Clang get their __atomic builtins. MSVC has no such builtins, but an aligned
+// volatile access of at most pointer size is never torn, so a volatile access paired with
+// a fence gives the same ordering on both x86 and ARM.
+namespace atomic_access {
+
+template <typename T>
+inline T LoadRelaxed(const T& field) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  return *static_cast<const volatile T*>(&field);
+#else
+  return __atomic_load_n(&field, __ATOMIC_RELAXED);
+#endif
+}
+
+template <typename T>
+inline T LoadAcquire(const T& field) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  T value = *static_cast<const volatile T*>(&field);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return value;
+#else
+  return __atomic_load_n(&field, __ATOMIC_ACQUIRE);
+#endif
+}
+
+template <typename T>
+inline void StoreRelaxed(T& field, T value) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  *static_cast<volatile T*>(&field) = value;
+#else
+  __atomic_store_n(&field, value, __ATOMIC_RELAXED);
+#endif
+}
+
+template <typename T>
+inline void StoreRelease(T& field, T value) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  std::atomic_thread_fence(std::memory_order_release);
+  *static_cast<volatile T*>(&field) = value;
+#else
+  __atomic_store_n(&field, value, __ATOMIC_RELEASE);
+#endif
+}
+
+}  // namespace atomic_access
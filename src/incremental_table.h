@@ -0,0 +1,450 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <utility>
+
+#include "atomic_access.h"
+
+// Chained hash table that grows incrementally. When it fills up, a bucket array twice the
+// size is allocated and every later operation moves a few old buckets across, so no single
+// insert pays for rehashing the whole table. Nodes are allocated individually and only ever
+// relinked, so pointers to them stay valid until the entry is erased.
+//
+// Nodes are also kept on a list in insertion order, which callers can reorder with
+// MoveToNewest to implement CLOCK or LRU style eviction.
+//
+// Hash must return the key's (precomputed) hash; bucket counts are powers of two.
+//
+// The table is not thread-safe, with one exception: FindConcurrent may run while another
+// thread, holding whatever lock guards every other change, removes entries with UnlinkIf.
+template <typename Key, typename Value, typename Hash>
+class IncrementalTable {
+public:
+  struct Node {
+    Node* next;
+    Key key;
+    Value value;
+    // Neighbours on the insertion order list
+    Node* older;
+    Node* newer;
+  };
+
+  IncrementalTable() = default;
+
+  ~IncrementalTable() {
+    Clear();
+  }
+
+  IncrementalTable(const IncrementalTable&) = delete;
+  IncrementalTable& operator=(const IncrementalTable&) = delete;
+
+  void Swap(IncrementalTable& other) {
+    std::swap(buckets, other.buckets);
+    std::swap(bucketCount, other.bucketCount);
+    std::swap(old, other.old);
+    std::swap(oldCount, other.oldCount);
+    std::swap(rehashIndex, other.rehashIndex);
+    std::swap(count, other.count);
+    std::swap(oldest, other.oldest);
+    std::swap(newest, other.newest);
+  }
+
+  size_t Size() const {
+    return count;
+  }
+
+  // Size for a thread that doesn't hold the writers' lock; see FindConcurrent
+  size_t SizeConcurrent() const {
+    return atomic_access::LoadRelaxed(count);
+  }
+
+  bool Rehashing() const {
+    return old != nullptr;
+  }
+
+  Node* Oldest() const {
+    return oldest;
+  }
+
+  void MoveToNewest(Node* node) {
+    if (node == newest) {
+      return;
+    }
+    Unorder(node);
+    Order(node);
+  }
+
+  // Size the table for n entries up front, so growing to n never rehashes
+  void Reserve(size_t n) {
+    size_t wanted = kMinBuckets;
+    while (wanted < n) {
+      wanted <<= 1;
+    }
+    if (wanted <= bucketCount) {
+      return;
+    }
+
+    FinishRehash();
+    if (count == 0) {
+      std::free(buckets);
+      buckets = AllocateBuckets(wanted);
+      bucketCount = wanted;
+      return;
+    }
+    StartRehash(wanted);
+    FinishRehash();
+  }
+
+  Node* Find(const Key& key) {
+    Step();
+    uint64_t hash = hasher(key);
+
+    // Entries from before the current resize stay in the old buckets until moved
+    if (old != nullptr) {
+      size_t index = hash & (oldCount - 1);
+      if (index >= rehashIndex) {
+        for (Node* node = old[index]; node != nullptr; node = node->next) {
+          if (node->key == key) {
+            return node;
+          }
+        }
+      }
+    }
+
+    if (buckets == nullptr) {
+      return nullptr;
+    }
+    for (Node* node = buckets[hash & (bucketCount - 1)]; node != nullptr; node = node->next) {
+      if (node->key == key) {
+        return node;
+      }
+    }
+    return nullptr;
+  }
+
+  // Find for a thread that doesn't hold the writers' lock, while another thread may be
+  // running UnlinkIf. Never moves buckets, so nothing but UnlinkIf may run concurrently.
+  // Unlinked nodes must be kept alive until no such lookup can still be on them, and a
+  // lookup that was on one may miss the rest of its chain, so a miss is only a hint.
+  Node* FindConcurrent(const Key& key) const {
+    uint64_t hash = hasher(key);
+    if (old != nullptr) {
+      size_t index = hash & (oldCount - 1);
+      if (index >= rehashIndex) {
+        for (Node* node = Load(old[index]); node != nullptr; node = Load(node->next)) {
+          if (node->key == key) {
+            return node;
+          }
+        }
+      }
+    }
+
+    if (buckets == nullptr) {
+      return nullptr;
+    }
+    for (Node* node = Load(buckets[hash & (bucketCount - 1)]); node != nullptr; node = Load(node->next)) {
+      if (node->key == key) {
+        return node;
+      }
+    }
+    return nullptr;
+  }
+
+  // Adds an entry for a key that is not in the table yet
+  Node* Insert(Key key, Value value) {
+    Step();
+
+    if (buckets == nullptr) {
+      buckets = AllocateBuckets(kMinBuckets);
+      bucketCount = kMinBuckets;
+    } else if (old == nullptr && count >= bucketCount) {
+      StartRehash(bucketCount * 2);
+    }
+
+    Node* node = new Node{nullptr, std::move(key), std::move(value), nullptr, nullptr};
+    Node*& head = buckets[hasher(node->key) & (bucketCount - 1)];
+    node->next = head;
+    head = node;
+    Order(node);
+    count++;
+    return node;
+  }
+
+  void Erase(Node* node) {
+    delete Unlink(node);
+  }
+
+  // Removes node from the table without destroying it
+  Node* Unlink(Node* node) {
+    Step();
+
+    Node** link = LinkTo(node);
+    *link = node->next;
+    node->next = nullptr;
+    Unorder(node);
+    count--;
+    return node;
+  }
+
+  template <typename Fn>
+  void ForEach(Fn fn) const {
+    if (old != nullptr) {
+      for (size_t i = rehashIndex; i < oldCount; i++) {
+        for (const Node* node = old[i]; node != nullptr; node = node->next) {
+          fn(*node);
+        }
+      }
+    }
+    for (size_t i = 0; i < bucketCount; i++) {
+      for (const Node* node = buckets[i]; node != nullptr; node = node->next) {
+        fn(*node);
+      }
+    }
+  }
+
+  // Erases every entry the predicate returns true for; returns how many were erased
+  template <typename Predicate>
+  size_t EraseIf(Predicate predicate) {
+    size_t erased = 0;
+    if (old != nullptr) {
+      erased += EraseIfIn(old, rehashIndex, oldCount, predicate);
+    }
+    erased += EraseIfIn(buckets, 0, bucketCount, predicate);
+    return erased;
+  }
+
+  // Like EraseIf, but hands the removed nodes back, linked through next, instead of
+  // destroying them
+  template <typename Predicate>
+  Node* UnlinkIf(Predicate predicate) {
+    Node* removed = nullptr;
+    if (old != nullptr) {
+      UnlinkIfIn(old, rehashIndex, oldCount, predicate, removed);
+    }
+    UnlinkIfIn(buckets, 0, bucketCount, predicate, removed);
+    return removed;
+  }
+
+  // Destroys up to limit entries, for tearing down a table that is no longer in use a
+  // piece at a time; returns how many were destroyed
+  size_t DrainSome(size_t limit) {
+    // Nodes go in bucket order, so the order list is meaningless from here on
+    oldest = nullptr;
+    newest = nullptr;
+    size_t destroyed = 0;
+    while (destroyed < limit && old != nullptr) {
+      destroyed += DestroyChain(old[rehashIndex], limit - destroyed);
+      if (old[rehashIndex] == nullptr && ++rehashIndex >= oldCount) {
+        std::free(old);
+        old = nullptr;
+        oldCount = 0;
+        rehashIndex = 0;
+      }
+    }
+    while (destroyed < limit && bucketCount > 0) {
+      destroyed += DestroyChain(buckets[bucketCount - 1], limit - destroyed);
+      if (buckets[bucketCount - 1] == nullptr) {
+        bucketCount--;
+      }
+    }
+    if (bucketCount == 0) {
+      std::free(buckets);
+      buckets = nullptr;
+    }
+    return destroyed;
+  }
+
+  void Clear() {
+    EraseIf([](Node&) { return true; });
+    std::free(old);
+    std::free(buckets);
+    old = nullptr;
+    buckets = nullptr;
+    oldCount = 0;
+    bucketCount = 0;
+    rehashIndex = 0;
+    oldest = nullptr;
+    newest = nullptr;
+  }
+
+private:
+  static constexpr size_t kMinBuckets = 16;
+  // Buckets moved per operation while resizing, and how many empty ones may be skipped
+  // per moved bucket before giving up for this operation
+  static constexpr size_t kStepBuckets = 4;
+  static constexpr size_t kEmptyVisitsPerStep = 10;
+
+  // Links UnlinkIf may change under FindConcurrent are read and written atomically
+  static Node* Load(Node* const& link) {
+    return atomic_access::LoadAcquire(link);
+  }
+
+  static void Store(Node*& link, Node* node) {
+    atomic_access::StoreRelease(link, node);
+  }
+
+  // calloc'd arrays are zeroed lazily by the OS, so even a huge new bucket array costs
+  // nothing until its buckets are used
+  static Node** AllocateBuckets(size_t n) {
+    Node** array = static_cast<Node**>(std::calloc(n, sizeof(Node*)));
+    if (array == nullptr) {
+      throw std::bad_alloc();
+    }
+    return array;
+  }
+
+  void StartRehash(size_t newCount) {
+    old = buckets;
+    oldCount = bucketCount;
+    rehashIndex = 0;
+    buckets = AllocateBuckets(newCount);
+    bucketCount = newCount;
+  }
+
+  void FinishRehash() {
+    while (old != nullptr) {
+      Step(oldCount);
+    }
+  }
+
+  void Step(size_t moves = kStepBuckets) {
+    if (old == nullptr) {
+      return;
+    }
+
+    size_t emptyVisits = moves * kEmptyVisitsPerStep;
+    while (moves > 0 && rehashIndex < oldCount) {
+      Node* node = old[rehashIndex];
+      if (node == nullptr) {
+        rehashIndex++;
+        if (--emptyVisits == 0) {
+          break;
+        }
+        continue;
+      }
+
+      while (node != nullptr) {
+        Node* next = node->next;
+        Node*& head = buckets[hasher(node->key) & (bucketCount - 1)];
+        node->next = head;
+        head = node;
+        node = next;
+      }
+      old[rehashIndex++] = nullptr;
+      moves--;
+    }
+
+    if (rehashIndex >= oldCount) {
+      std::free(old);
+      old = nullptr;
+      oldCount = 0;
+      rehashIndex = 0;
+    }
+  }
+
+  // Appends node to the order list as its newest entry
+  void Order(Node* node) {
+    node->older = newest;
+    node->newer = nullptr;
+    if (newest != nullptr) {
+      newest->newer = node;
+    } else {
+      oldest = node;
+    }
+    newest = node;
+  }
+
+  void Unorder(Node* node) {
+    (node->older != nullptr ? node->older->newer : oldest) = node->newer;
+    (node->newer != nullptr ? node->newer->older : newest) = node->older;
+    node->older = nullptr;
+    node->newer = nullptr;
+  }
+
+  // The pointer that links to node, in whichever bucket array holds it
+  Node** LinkTo(Node* node) {
+    uint64_t hash = hasher(node->key);
+    Node** link = nullptr;
+    if (old != nullptr && (hash & (oldCount - 1)) >= rehashIndex) {
+      link = &old[hash & (oldCount - 1)];
+      while (*link != nullptr && *link != node) {
+        link = &(*link)->next;
+      }
+      if (*link == node) {
+        return link;
+      }
+    }
+
+    link = &buckets[hash & (bucketCount - 1)];
+    while (*link != node) {
+      link = &(*link)->next;
+    }
+    return link;
+  }
+
+  size_t DestroyChain(Node*& head, size_t limit) {
+    size_t destroyed = 0;
+    while (head != nullptr && destroyed < limit) {
+      Node* node = head;
+      head = node->next;
+      delete node;
+      count--;
+      destroyed++;
+    }
+    return destroyed;
+  }
+
+  template <typename Predicate>
+  void UnlinkIfIn(Node** array, size_t from, size_t to, Predicate& predicate, Node*& removed) {
+    for (size_t i = from; i < to; i++) {
+      Node** link = &array[i];
+      while (*link != nullptr) {
+        Node* node = *link;
+        if (predicate(*node)) {
+          Store(*link, node->next);
+          Unorder(node);
+          Store(node->next, removed);
+          removed = node;
+          atomic_access::StoreRelaxed(count, count - 1);
+        } else {
+          link = &node->next;
+        }
+      }
+    }
+  }
+
+  template <typename Predicate>
+  size_t EraseIfIn(Node** array, size_t from, size_t to, Predicate& predicate) {
+    size_t erased = 0;
+    for (size_t i = from; i < to; i++) {
+      Node** link = &array[i];
+      while (*link != nullptr) {
+        Node* node = *link;
+        if (predicate(*node)) {
+          *link = node->next;
+          Unorder(node);
+          delete node;
+          atomic_access::StoreRelaxed(count, count - 1);
+          erased++;
+        } else {
+          link = &node->next;
+        }
+      }
+    }
+    return erased;
+  }
+
+  Hash hasher;
+  Node** buckets = nullptr;
+  size_t bucketCount = 0;
+  // Buckets of the table being migrated away from; [0, rehashIndex) are already moved
+  Node** old = nullptr;
+  size_t oldCount = 0;
+  size_t rehashIndex = 0;
+  size_t count = 0;
+  Node* oldest = nullptr;
+  Node* newest = nullptr;
+};
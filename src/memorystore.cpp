@@ -7,20 +7,606 @@
 #include <atomic>
 #include <vector>
 #include <memory>
+#include <string>
+#include <functional>
+#include <unordered_set>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <deque>
+
+#include "hash.h"
+#include "incremental_table.h"
+#include "adaptive_mutex.h"
+#include "wire_protocol.h"
+
+struct KeyPrefix;
+
+// Key bytes plus their hash, computed once so table lookups never rehash the bytes.
+// Keys that don't come from strings start with a NUL and a kind byte; string keys that
+// happen to start with a NUL get a second one, so the two spaces can never collide.
+// Stored keys may share an interned prefix, in which case str only holds the rest.
+struct StoreKey {
+  enum Kind : char {
+    Identity = 'i',
+    Structural = 's',
+    Binary = 'b'
+  };
+
+  const KeyPrefix* prefix = nullptr;
+  std::string str;
+  uint64_t hash = 0;
+
+  StoreKey() = default;
+
+  static StoreKey FromString(std::string s, uint64_t seed) {
+    if (!s.empty() && s[0] == '\0') {
+      s.insert(0, 1, '\0');
+    }
+    return StoreKey(std::move(s), seed);
+  }
+
+  static StoreKey Tagged(Kind kind, const std::string& payload, uint64_t seed) {
+    return Tagged(kind, payload.data(), payload.size(), seed);
+  }
+
+  static StoreKey Tagged(Kind kind, const char* data, size_t length, uint64_t seed) {
+    std::string s;
+    s.reserve(length + 2);
+    s.push_back('\0');
+    s.push_back(kind);
+    s.append(data, length);
+    return StoreKey(std::move(s), seed);
+  }
+
+  // The same key hashed for a store with a different seed
+  StoreKey Rehashed(uint64_t seed) const {
+    return StoreKey(Bytes(), seed);
+  }
+
+  // Stored form of a key whose first prefixLength bytes are interned
+  static StoreKey WithPrefix(const StoreKey& key, const KeyPrefix* prefix, size_t prefixLength) {
+    StoreKey stored;
+    stored.prefix = prefix;
+    stored.str = key.str.substr(prefixLength);
+    stored.hash = key.hash;
+    return stored;
+  }
+
+  // Only string keys are ever prefixed, and those never start with a kind tag
+  bool IsTagged() const {
+    return prefix == nullptr && str.size() >= 2 && str[0] == '\0' && str[1] != '\0';
+  }
+
+  bool IsKind(Kind kind) const {
+    return prefix == nullptr && str.size() >= 2 && str[0] == '\0' && str[1] == kind;
+  }
+
+  size_t Length() const;
+  std::string Bytes() const;
+
+  // The original string of a string key
+  std::string ToString() const {
+    std::string bytes = Bytes();
+    return !bytes.empty() && bytes[0] == '\0' ? bytes.substr(1) : bytes;
+  }
+
+  bool operator==(const StoreKey& other) const;
+
+private:
+  StoreKey(std::string s, uint64_t seed) : str(std::move(s)), hash(keyhash::Hash(str.data(), str.size(), seed)) {}
+};
+
+// Interned key prefix shared by every stored key that starts with it
+struct KeyPrefix {
+  std::string str;
+  size_t refs = 0;
+};
+
+inline size_t StoreKey::Length() const {
+  return (prefix != nullptr ? prefix->str.size() : 0) + str.size();
+}
+
+inline std::string StoreKey::Bytes() const {
+  return prefix != nullptr ? prefix->str + str : str;
+}
+
+inline bool StoreKey::operator==(const StoreKey& other) const {
+  if (hash != other.hash || Length() != other.Length()) {
+    return false;
+  }
+  if (prefix == other.prefix) {
+    return str == other.str;
+  }
+  
+  // Lookups carry the whole key, so compare it against the stored prefix and rest
+  if (other.prefix == nullptr) {
+    return other.str.compare(0, prefix->str.size(), prefix->str) == 0 &&
+           other.str.compare(prefix->str.size(), std::string::npos, str) == 0;
+  }
+  if (prefix == nullptr) {
+    return other == *this;
+  }
+  return Bytes() == other.Bytes();
+}
+
+struct StoreKeyHash {
+  size_t operator()(const StoreKey& key) const { return static_cast<size_t>(key.hash); }
+};
+
+struct SeededStringHash {
+  uint64_t seed = 0;
+  size_t operator()(const std::string& str) const {
+    return static_cast<size_t>(keyhash::Hash(str.data(), str.size(), seed));
+  }
+};
+
+// Interns the part of each stored string key up to its last delimiter, so keys like
+// "tenant:4711:user:42:session:abc" keep one copy of "tenant:4711:user:42:session:"
+// and each entry only holds its final segment (usually short enough to stay inline).
+// Prefixes are reference counted and dropped with the last key that uses them.
+class KeyPrefixPool {
+public:
+  void Enable(char keyDelimiter, uint64_t seed) {
+    enabled = true;
+    delimiter = keyDelimiter;
+    prefixes = PrefixMap(16, SeededStringHash{seed});
+  }
+
+  // The form of key to keep in the table
+  StoreKey Intern(const StoreKey& key) {
+    if (!enabled || key.prefix != nullptr || key.str.empty() || key.str[0] == '\0') {
+      return key;
+    }
+    
+    size_t end = key.str.rfind(delimiter);
+    if (end == std::string::npos || end + 1 < kMinPrefixLength) {
+      return key;
+    }
+    
+    std::string prefixString = key.str.substr(0, end + 1);
+    auto& prefix = prefixes[prefixString];
+    if (!prefix) {
+      prefix = std::make_unique<KeyPrefix>();
+      prefix->str = std::move(prefixString);
+    }
+    prefix->refs++;
+    return StoreKey::WithPrefix(key, prefix.get(), end + 1);
+  }
+
+  // Called when a stored key leaves the table
+  void Release(const StoreKey& key) {
+    if (key.prefix == nullptr) {
+      return;
+    }
+    
+    auto it = prefixes.find(key.prefix->str);
+    if (it != prefixes.end() && --it->second->refs == 0) {
+      prefixes.erase(it);
+    }
+  }
+
+  // Like Release, but an unused prefix is only freed by a later Sweep, for threads that
+  // must not free memory a lock-free lookup may be comparing keys against
+  void ReleaseLater(const StoreKey& key) {
+    if (key.prefix == nullptr) {
+      return;
+    }
+    
+    auto it = prefixes.find(key.prefix->str);
+    if (it != prefixes.end() && --it->second->refs == 0) {
+      unused++;
+    }
+  }
+
+  // Frees the prefixes ReleaseLater left unused, once they are a sizable share of the pool
+  void Sweep() {
+    if (unused == 0 || unused * 4 < prefixes.size()) {
+      return;
+    }
+    for (auto it = prefixes.begin(); it != prefixes.end();) {
+      it = it->second->refs == 0 ? prefixes.erase(it) : std::next(it);
+    }
+    unused = 0;
+  }
+
+  void Clear() {
+    prefixes.clear();
+    unused = 0;
+  }
+
+private:
+  // Shorter prefixes cost about as much to point at as to copy
+  static constexpr size_t kMinPrefixLength = 8;
+
+  using PrefixMap = std::unordered_map<std::string, std::unique_ptr<KeyPrefix>, SeededStringHash>;
+
+  bool enabled = false;
+  char delimiter = ':';
+  PrefixMap prefixes;
+  // Prefixes left in place by ReleaseLater (an upper bound; some may be in use again)
+  size_t unused = 0;
+};
+
+// Persistent handle to any JS value. Node-API before v10 can only reference objects,
+// functions and symbols, so primitives are kept alive inside a one-element array.
+class ValueRef {
+public:
+  ValueRef() = default;
+  explicit ValueRef(const Napi::Value& value) { Reset(value); }
+
+  void Reset(const Napi::Value& value) {
+    boxed = !(value.IsObject() || value.IsSymbol());
+    if (boxed) {
+      Napi::Array box = Napi::Array::New(value.Env(), 1);
+      box.Set(0u, value);
+      ref = Napi::Persistent(static_cast<Napi::Value>(box));
+    } else {
+      ref = Napi::Persistent(value);
+    }
+  }
+
+  // Like Reset, but when both the old and the new value are primitives the box is reused,
+  // so overwriting a counter allocates no new reference
+  void Assign(const Napi::Value& value) {
+    if (boxed && !(value.IsObject() || value.IsSymbol())) {
+      ref.Value().As<Napi::Object>().Set(0u, value);
+      return;
+    }
+    Reset(value);
+  }
+
+  Napi::Value Value() const {
+    if (boxed) {
+      return ref.Value().As<Napi::Object>().Get(0u);
+    }
+    return ref.Value();
+  }
+
+  void Clear() {
+    ref.Reset();
+    boxed = false;
+  }
+
+  bool IsEmpty() const {
+    return ref.IsEmpty();
+  }
+
+private:
+  Napi::Reference<Napi::Value> ref;
+  bool boxed = false;
+};
+
+// An entry's value. Numbers are held natively rather than through a ValueRef, so they
+// cost no reference at all and counters are updated in place without touching JS. Values
+// written through the binary protocol are held natively too, as bytes or a UTF-8 string.
+class EntryValue {
+public:
+  enum class Kind : uint8_t { Reference, Integer, Real, Bytes, String };
+
+  EntryValue() = default;
+
+  EntryValue(EntryValue&& other) noexcept : ref(std::move(other.ref)) {
+    Take(other);
+  }
+
+  EntryValue& operator=(EntryValue&& other) noexcept {
+    if (this != &other) {
+      ReleaseBytes();
+      ref = std::move(other.ref);
+      Take(other);
+    }
+    return *this;
+  }
+
+  ~EntryValue() {
+    ReleaseBytes();
+  }
+
+  void Assign(const Napi::Value& value) {
+    if (value.IsNumber()) {
+      SetReal(value.As<Napi::Number>().DoubleValue());
+      return;
+    }
+    ReleaseBytes();
+    kind = Kind::Reference;
+    ref.Assign(value);
+  }
+
+  void SetInteger(int64_t value) {
+    ref.Clear();
+    ReleaseBytes();
+    kind = Kind::Integer;
+    integer = value;
+  }
+
+  // Whole numbers JS can represent exactly are kept as integers, so incr() works on them
+  void SetReal(double value) {
+    const double kMaxSafeInteger = 9007199254740991.0;
+    if (std::trunc(value) == value && std::fabs(value) <= kMaxSafeInteger && !(value == 0 && std::signbit(value))) {
+      SetInteger(static_cast<int64_t>(value));
+      return;
+    }
+    ref.Clear();
+    ReleaseBytes();
+    kind = Kind::Real;
+    real = value;
+  }
+
+  // Kind::Bytes or Kind::String
+  void SetBytes(Kind bytesKind, const char* data, size_t length) {
+    ref.Clear();
+    if (kind == Kind::Bytes || kind == Kind::String) {
+      bytes->assign(data, length);
+    } else {
+      bytes = new std::string(data, length);
+    }
+    kind = bytesKind;
+  }
+
+  Kind GetKind() const {
+    return kind;
+  }
+
+  int64_t Integer() const {
+    return integer;
+  }
+
+  double Real() const {
+    return kind == Kind::Integer ? static_cast<double>(integer) : real;
+  }
+
+  const std::string& Bytes() const {
+    return *bytes;
+  }
+
+  Napi::Value Value(Napi::Env env) const {
+    switch (kind) {
+      case Kind::Integer:
+        return Napi::Number::New(env, static_cast<double>(integer));
+      case Kind::Real:
+        return Napi::Number::New(env, real);
+      case Kind::Bytes:
+        return Napi::Buffer<char>::Copy(env, bytes->data(), bytes->size());
+      case Kind::String:
+        return Napi::String::New(env, *bytes);
+      default:
+        return ref.Value();
+    }
+  }
+
+private:
+  void ReleaseBytes() {
+    if (kind == Kind::Bytes || kind == Kind::String) {
+      delete bytes;
+      kind = Kind::Reference;
+    }
+  }
+
+  // Moves other's native value here, leaving other an empty reference
+  void Take(EntryValue& other) {
+    kind = other.kind;
+    switch (kind) {
+      case Kind::Real:
+        real = other.real;
+        break;
+      case Kind::Bytes:
+      case Kind::String:
+        bytes = other.bytes;
+        break;
+      default:
+        integer = other.integer;
+        break;
+    }
+    other.kind = Kind::Reference;
+  }
+
+  ValueRef ref;
+  Kind kind = Kind::Reference;
+  union {
+    int64_t integer = 0;
+    double real;
+    std::string* bytes;
+  };
+};
+
+// Raw bytes viewed by a TypedArray (including Buffer); false for anything else
+static bool GetTypedArrayBytes(napi_env env, napi_value value, const char*& data, size_t& length) {
+  bool isTypedArray = false;
+  if (napi_is_typedarray(env, value, &isTypedArray) != napi_ok || !isTypedArray) {
+    return false;
+  }
+  
+  napi_typedarray_type type;
+  size_t elements;
+  void* elementData;
+  if (napi_get_typedarray_info(env, value, &type, &elements, &elementData, nullptr, nullptr) != napi_ok) {
+    return false;
+  }
+  
+  size_t elementSize = 1;
+  switch (type) {
+    case napi_int16_array:
+    case napi_uint16_array:
+      elementSize = 2;
+      break;
+    case napi_int32_array:
+    case napi_uint32_array:
+    case napi_float32_array:
+      elementSize = 4;
+      break;
+    case napi_float64_array:
+    case napi_bigint64_array:
+    case napi_biguint64_array:
+      elementSize = 8;
+      break;
+    default:
+      break;
+  }
+  
+  data = static_cast<const char*>(elementData);
+  length = elements * elementSize;
+  return true;
+}
+
+// Rough footprint of a value for byte quotas: string and binary lengths are known,
+// anything else counts as a small fixed size unless set() is given an explicit size
+static size_t EstimateValueBytes(napi_env env, napi_value value) {
+  const size_t kObjectBytes = 64;
+  const size_t kPrimitiveBytes = 8;
+  
+  napi_valuetype type;
+  if (napi_typeof(env, value, &type) != napi_ok) {
+    return kPrimitiveBytes;
+  }
+  
+  if (type == napi_string) {
+    size_t length = 0;
+    napi_get_value_string_utf8(env, value, nullptr, 0, &length);
+    return length;
+  }
+  
+  if (type == napi_object) {
+    const char* bytes;
+    size_t length;
+    if (GetTypedArrayBytes(env, value, bytes, length)) {
+      return length;
+    }
+    bool isArrayBuffer = false;
+    if (napi_is_arraybuffer(env, value, &isArrayBuffer) == napi_ok && isArrayBuffer) {
+      void* data;
+      napi_get_arraybuffer_info(env, value, &data, &length);
+      return length;
+    }
+    return kObjectBytes;
+  }
+  
+  return type == napi_function ? kObjectBytes : kPrimitiveBytes;
+}
+
+// Uniform in [0, 1), for TTL jitter and early expiration. Per thread, so it needs no lock.
+static double RandomUnit() {
+  thread_local std::mt19937_64 generator(keyhash::RandomSeed(reinterpret_cast<uintptr_t>(&generator)));
+  return static_cast<double>(generator() >> 11) * 0x1.0p-53;
+}
+
+// Adds delta to a counter; false if the sum falls outside the integers a JS number holds
+// exactly, which is as far as counters go. The check comes first, so the sum can't overflow.
+static bool AddToCounter(int64_t count, int64_t delta, int64_t& sum) {
+  const int64_t kMaxSafeInteger = 9007199254740991;
+  if (delta > 0 ? count > kMaxSafeInteger - delta : count < -kMaxSafeInteger - delta) {
+    return false;
+  }
+  sum = count + delta;
+  return sum >= -kMaxSafeInteger && sum <= kMaxSafeInteger;
+}
+
+struct KeyHandle;
+
+// Id attached with napi_wrap to objects used as identity keys
+struct IdentityTag {
+  uint64_t id;
+};
+
+// Per-environment state, kept as instance data so worker threads don't share it
+struct AddonData {
+  Napi::FunctionReference memoryStoreConstructor;
+  // Live handles, so an External from elsewhere is never mistaken for one
+  std::unordered_set<const KeyHandle*> keyHandles;
+  // Live identity tags, so objects wrapped by other native code are never misread
+  std::unordered_set<const IdentityTag*> identityTags;
+  uint64_t nextIdentityId = 1;
+  // Set only while namespace() constructs a view, so views can't be forged from JS
+  void* pendingView = nullptr;
+};
+
+// How object keys (other than mutable keys) are turned into store keys
+enum class ObjectKeyMode {
+  Json,       // JSON.stringify, the original behaviour
+  Identity,   // Same object, same entry
+  Structural  // Canonical native encoding, property order doesn't matter
+};
+
+// Every keyspace gets a distinct id so handles never trust a slot cached by another one
+static std::atomic<uint64_t> nextKeyspaceId{1};
 
 class MemoryStore : public Napi::ObjectWrap<MemoryStore> {
 public:
   static Napi::Object Init(Napi::Env env, Napi::Object exports);
   MemoryStore(const Napi::CallbackInfo& info);
-  ~MemoryStore();
 
 private:
+  friend struct KeyHandle;
+
   struct StoreItem {
-    Napi::Reference<Napi::Value> value;
-    Napi::Reference<Napi::Value> keyRef; // Store reference to the key
+    EntryValue value;
+    ValueRef keyRef; // Store reference to the key
     bool isPermanent;
     std::chrono::steady_clock::time_point expiresAt;
     uint64_t maxAgeMs;
+    // Soft deadline: from here on reads return the value but start reloading it
+    std::chrono::steady_clock::time_point refreshAt = std::chrono::steady_clock::time_point::max();
+    uint32_t staleAfterMs = 0;
+    uint32_t refreshAheadMs = 0;
+    float ttlJitter = 0;
+    // Early expiration (XFetch): how long the value took to load, and how eagerly to
+    // reload it before it expires; 0 disables it
+    uint32_t computeMs = 0;
+    float earlyExpiryBeta = 0;
+    size_t bytes = 0; // Estimated footprint, counted against quotas
+    // Changes on every write, for compare-and-set; 0 is never used, so it can stand for
+    // a missing key
+    uint64_t version = 0;
+    bool referenced = false; // Used since the eviction hand last passed it
+
+    bool Expired(std::chrono::steady_clock::time_point now) const {
+      return !isPermanent && maxAgeMs > 0 && now >= expiresAt;
+    }
+  };
+
+  using StoreTable = IncrementalTable<StoreKey, StoreItem, StoreKeyHash>;
+  using Entry = StoreTable::Node;
+
+  // Marks a key as known to be missing, set by setMissing() or when a loader finds nothing
+  // for it, until it expires. Holds no references, so it costs a fraction of an entry.
+  struct Tombstone {
+    std::chrono::steady_clock::time_point expiresAt;
+  };
+
+  using TombstoneTable = IncrementalTable<StoreKey, Tombstone, StoreKeyHash>;
+
+  // Entries detached from the table by clear(), deleteAsync() or the cleanup thread wait
+  // here until the JS thread releases them, a slice per tick. Their references may only be
+  // deleted on the JS thread, and releasing millions in one go stalls it for seconds.
+  class Graveyard : public std::enable_shared_from_this<Graveyard> {
+  public:
+    void Bury(std::unique_ptr<StoreTable> table);
+    // A list of entries linked through next; done is resolved once they are released
+    void Bury(Entry* entries, std::unique_ptr<Napi::Promise::Deferred> done = nullptr);
+    // Must be called on the JS thread
+    void Schedule(Napi::Env env);
+
+    // The signal lets other threads ask for a drain. Node closes it on its own at
+    // environment teardown, so it is only ever touched under signalMutex while open.
+    void OpenSignal(Napi::Env env);
+    void CloseSignal();
+    void Signal();
+
+  private:
+    struct Batch {
+      std::unique_ptr<StoreTable> table;
+      Entry* entries = nullptr;
+      std::unique_ptr<Napi::Promise::Deferred> done;
+    };
+
+    void DrainStep(Napi::Env env);
+
+    std::mutex mutex;
+    std::deque<Batch> batches;
+    bool scheduled = false; // Only touched on the JS thread
+    std::mutex signalMutex;
+    Napi::ThreadSafeFunction signal;
+    bool signalOpen = false;
   };
 
   // Custom key wrapper for proxy monitoring
@@ -29,6 +615,157 @@ private:
     Napi::ObjectReference proxyRef;
   };
 
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t sets = 0;
+    uint64_t deletes = 0;
+    uint64_t expired = 0;
+    uint64_t evicted = 0;
+    uint64_t loads = 0;
+    uint64_t coalesced = 0;
+    uint64_t refreshes = 0;
+    uint64_t earlyExpired = 0;
+    uint64_t batches = 0;
+    uint64_t negativeHits = 0;
+    uint64_t unchanged = 0; // getIfChanged() hits at the caller's version
+  };
+
+  // Lifetime and size options of set() and getOrLoad()
+  struct SetOptions {
+    bool isPermanent = true;
+    uint64_t maxAgeMs = 0;
+    uint32_t staleAfterMs = 0;
+    uint32_t refreshAheadMs = 0;
+    // Fraction of maxAgeMs the lifetime is randomly shortened by, up to 1
+    double ttlJitter = 0;
+    uint32_t computeMs = 0;
+    double earlyExpiryBeta = 0;
+    bool sized = false;
+    size_t valueBytes = 0; // Only used when sized
+  };
+
+  // A load started by getOrLoad(). Callers missing the same key while it runs await its
+  // promise instead of starting loads of their own. Only touched on the JS thread.
+  struct Flight {
+    explicit Flight(Napi::Env env) : deferred(Napi::Promise::Deferred::New(env)) {}
+
+    StoreKey key;
+    ValueRef keyRef;
+    SetOptions options;
+    // Loads that don't say what they cost are timed
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    Napi::Promise::Deferred deferred;
+    Napi::ObjectReference promise;
+    // The store the result goes into, kept alive until the load settles
+    Napi::ObjectReference owner;
+  };
+
+  // Entry and byte caps; 0 means unlimited
+  struct Limits {
+    size_t maxEntries = 0;
+    size_t maxBytes = 0;
+
+    bool Exceeded(size_t entries, size_t bytes) const {
+      return (maxEntries > 0 && entries > maxEntries) || (maxBytes > 0 && bytes > maxBytes);
+    }
+  };
+
+  // An isolated set of keys: the store itself, or one of its namespaces
+  struct Keyspace {
+    const uint64_t id = nextKeyspaceId.fetch_add(1);
+    StoreTable table;
+    KeyPrefixPool keyPrefixes;
+    size_t expectedSize = 0;
+    // Lifetime of entries set without isPermanent or maxAgeMs; 0 keeps them permanent
+    uint64_t defaultMaxAgeMs = 0;
+    // Defaults for set()'s ttlJitter and earlyExpiryBeta
+    double ttlJitter = 0;
+    double earlyExpiryBeta = 0;
+    Stats stats;
+    Limits quota;
+    // Sum of the entries' estimated footprints
+    size_t bytes = 0;
+    // Evictions left before the next sweep for expired entries; see EvictOne
+    size_t evictionsUntilSweep = 0;
+    // Bumped whenever entries are erased; handles compare it before using a cached slot.
+    // Atomic since lock-free lookups read it while the cleanup thread bumps it.
+    std::atomic<uint64_t> generation{0};
+    // Sequence lock for lock-free lookups: odd while the cleanup thread is changing the
+    // keyspace's tables, and advanced past each such change
+    std::atomic<uint64_t> sequence{0};
+    // Last version given to a write. Shared by all of the keyspace's entries, so a key that
+    // is deleted and set again never gets a version it had before.
+    uint64_t version = 0;
+    // Loads in progress, by key
+    std::unordered_map<StoreKey, std::shared_ptr<Flight>, StoreKeyHash> flights;
+    // Reloads stale entries read with get(); empty if none was registered
+    Napi::FunctionReference loader;
+    // Loads many keys per call; when registered, misses are loaded through it
+    Napi::FunctionReference batchLoader;
+    // Loads waiting for the batch loader's next call, which runs once per tick
+    std::vector<std::shared_ptr<Flight>> batch;
+    // Keys a loader found nothing for, and how long to remember that; 0 disables it
+    TombstoneTable missing;
+    uint64_t negativeMaxAgeMs = 0;
+  };
+
+  // Everything a store shares with its namespaces: one lock, one cleanup thread sweeping
+  // every keyspace, one graveyard and the key encoding settings
+  class Engine {
+  public:
+    explicit Engine(Napi::Env env);
+    ~Engine();
+
+    // Must be called with mutex held
+    Keyspace* GetKeyspace(const std::string& name);
+    bool StartCleanup();
+    bool StopCleanup();
+
+    // Entry bookkeeping, kept incrementally so quotas never need a scan. All of these
+    // must be called with mutex held, and the ones that release entries on the JS thread.
+    void Account(Keyspace& keyspace, ptrdiff_t entries, ptrdiff_t bytes);
+    void Erase(Keyspace& keyspace, Entry* entry);
+    // Unlinks an entry without releasing it, for handing to the graveyard
+    Entry* Detach(Keyspace& keyspace, Entry* entry);
+    // Evicts until keyspace is within its quota and the engine within its budget
+    void EnforceLimits(Keyspace& keyspace);
+
+    AdaptiveMutex mutex;
+    std::unordered_map<std::string, std::unique_ptr<Keyspace>> keyspaces;
+    std::unordered_map<std::string, std::shared_ptr<KeyWrapper>> keyWrappers;
+    std::shared_ptr<Graveyard> graveyard;
+    ObjectKeyMode objectKeyMode = ObjectKeyMode::Json;
+    // Delimiter for interning key prefixes, or 0 when disabled
+    char keyPrefixDelimiter = 0;
+    // Per-store key hash seed, so colliding keys can't be precomputed
+    const uint64_t hashSeed;
+    uint64_t cleanupIntervalMs = 60000;
+    // Shared by all keyspaces
+    Limits budget;
+    size_t totalEntries = 0;
+    size_t totalBytes = 0;
+
+  private:
+    void CleanupExpiredItems();
+    void CleanupWorker();
+    // One CLOCK step: entries used since the hand last passed get a second chance
+    void EvictOne(Keyspace& keyspace);
+    Keyspace* PickVictim();
+    // Erases the keyspace's expired entries on the JS thread; returns how many
+    size_t EraseExpired(Keyspace& keyspace);
+
+    std::thread cleanupThread;
+    std::condition_variable_any cleanupCV;
+    std::atomic<bool> stopCleanup{true};
+  };
+
+  // What namespace() hands to the constructor of a view
+  struct ViewInit {
+    std::shared_ptr<Engine> engine;
+    Keyspace* keyspace;
+  };
+
   // Safe string conversion helper - improved to avoid crashes
   std::string SafeGetString(const Napi::Value& value) {
     if (value.IsNull() || value.IsUndefined()) {
@@ -71,10 +808,159 @@ private:
     return "[object Object]";
   }
 
+  // Resolve a JS key (string, primitive, mutable key or object) into its store key.
+  // Returns false with a JS exception pending if the key can't be encoded.
+  bool ResolveKey(const Napi::Value& keyValue, StoreKey& key);
+  bool ResolveObjectKey(const Napi::Object& keyObj, StoreKey& key);
+  bool IdentityKey(const Napi::Object& keyObj, StoreKey& key);
+  bool EncodeStructural(const Napi::Value& value, std::string& out, int depth);
+  KeyHandle* AsKeyHandle(const Napi::Value& value);
+  // A handle's precomputed key, or one resolved into scratch; nullptr if resolution failed
+  const StoreKey* LookupKey(const Napi::Value& keyValue, KeyHandle*& handle, StoreKey& scratch);
+  // Must be called with the engine's mutex held
+  Entry* FindEntry(const StoreKey& key, KeyHandle* handle);
+  // What a lock-free lookup could tell: a fresh entry, that the key has no live value (nor
+  // a tombstone), or neither, leaving it to the locked path
+  enum class Lookup { Fresh, Missing, Unsure };
+  // Lookup without the engine's mutex, for the JS thread only: every change to the tables
+  // happens on it, except the cleanup thread unlinking expired entries, which are only
+  // freed back on the JS thread. entry is set for Fresh.
+  Lookup LookupConcurrent(const StoreKey& key, KeyHandle* handle, Entry*& entry);
+  // Leaves the store over its limits if enforceLimits is false, for callers that enforce
+  // them once they are done
+  void InsertOrAssign(const StoreKey& key, StoreItem&& item, bool enforceLimits = true);
+  enum class Freshness {
+    Fresh,
+    Stale,    // Past its soft deadline
+    Expiring  // Picked for early expiration
+  };
+  // The entry for key unless it has expired, in which case it is erased. freshness, if
+  // given, is set to how fresh the entry is. Must be called with the engine's mutex held.
+  Entry* FindLive(const StoreKey& key, KeyHandle* handle, Freshness* freshness = nullptr);
+  // set()'s options, with this keyspace's default lifetime filled in
+  SetOptions ReadSetOptions(const Napi::Value& options) const;
+  // ReadSetOptions for a new counter, which maxAgeMs alone makes expire
+  SetOptions ReadCounterOptions(const Napi::Value& options) const;
+  // The options of a set() without any
+  SetOptions DefaultSetOptions() const;
+  // Stores value under key, in place when handle points at its entry. keyRef is the
+  // original key, kept for keys() and getKeys().
+  void StoreValue(const StoreKey& key, KeyHandle* handle, const Napi::Value& keyRef,
+                  const Napi::Value& value, const SetOptions& options);
+  // Replaces item's value, keeping its lifetime if options is null; must be called with
+  // the engine's mutex held. Returns the new version: enforcing the limits afterwards may
+  // evict the entry, so item must not be used once this returns.
+  uint64_t Overwrite(StoreItem& item, const Napi::Value& value, const SetOptions* options, size_t bytes,
+                     bool enforceLimits = true);
+  // Like StoreValue, for callers holding the engine's mutex that have already looked up
+  // key's live entry (nullptr if none); returns the new version. Leaves enforcing the
+  // limits to the caller, so entries it relies on can't be evicted under it.
+  uint64_t StoreValueLocked(const StoreKey& key, Entry* entry, const Napi::Value& keyRef,
+                            const Napi::Value& value, const SetOptions& options, size_t bytes);
+  // Counts a write to item and gives it a new version; must be called with the engine's
+  // mutex held
+  void RecordWrite(StoreItem& item) {
+    keyspace->stats.sets++;
+    item.version = ++keyspace->version;
+  }
+  // Options to reload an entry with, so the reloaded one keeps the same deadlines
+  static SetOptions ItemOptions(const StoreItem& item);
+  // The key an entry was stored under, as JS got it. Entries written through the binary
+  // protocol have no keyRef, so theirs is made from the stored key.
+  static Napi::Value OriginalKey(Napi::Env env, const Entry& entry);
+  
+  // One operation of transaction(), resolved before the lock is taken
+  struct TransactionOp {
+    enum class Type { Set, Delete, Incr, SetIfVersion, DeleteIfVersion };
+    Type type = Type::Set;
+    Napi::Value keyValue;
+    KeyHandle* handle = nullptr;
+    StoreKey scratch;
+    const StoreKey* key = nullptr;
+    Napi::Value value;
+    SetOptions options;
+    size_t bytes = 0;
+    int64_t delta = 0;
+    int64_t initial = 0;
+    uint64_t version = 0;
+    // Index of the transaction's first operation on the same key
+    size_t slot = 0;
+  };
+  // Reads ops[index] of transaction(); throws and returns false if it is malformed
+  bool ReadTransactionOp(Napi::Env env, const Napi::Value& spec, TransactionOp& op);
+  // get()'s lookup, counting hits and misses; must be called with the engine's mutex
+  // held. Returns an empty value on a miss, setting missing if the key is known to be
+  // missing. reload is set when the key should be loaded in the background, with keyRef
+  // and options set for reloading a stale entry.
+  Napi::Value ReadValue(Napi::Env env, const StoreKey& key, KeyHandle* handle, bool& missing, bool& reload,
+                        Napi::Value& keyRef, SetOptions& options);
+  // Promise for key's value: from the store, from a load already running, or from a new
+  // load by loader (or the batch loader if loader is empty)
+  Napi::Value LoadThrough(Napi::Env env, const StoreKey& key, KeyHandle* handle, const Napi::Value& keyRef,
+                          const Napi::Function& loader, const SetOptions& options);
+  // Calls loader for key, or queues key for the batch loader if loader is empty, and
+  // stores what it resolves to; returns the load's promise. Must be called without the
+  // engine's mutex held, since the loader may use the store.
+  Napi::Object StartLoad(Napi::Env env, const StoreKey& key, const Napi::Value& keyRef,
+                         const Napi::Function& loader, const SetOptions& options);
+  // Loads key with nobody waiting, unless a load of it is already running. stale marks
+  // reloads of entries past their soft deadline.
+  void LoadInBackground(Napi::Env env, const StoreKey& key, const Napi::Value& keyRef,
+                        const Napi::Function& loader, const SetOptions& options, bool stale);
+  // Hands every key queued since the last call to the batch loader
+  void DispatchBatch(Napi::Env env);
+  void SettleFlight(const std::shared_ptr<Flight>& flight, bool loaded, const Napi::Value& result);
+  // Sets item's lifetime and deadlines from options, counting from now
+  static void ApplyOptions(StoreItem& item, const SetOptions& options);
+  // Calls settle(true, value) once result, a value or a promise, resolves, or settle(false,
+  // error) if it rejects. A JS exception pending from producing result counts as a rejection.
+  static void SettleWhen(Napi::Env env, const Napi::Value& result,
+                         std::function<void(bool, const Napi::Value&)> settle);
+  // Runs one binary protocol request, writing its response to sink, which tells whether a
+  // response could ever fit with CanFit(payloadLength), hands out space with
+  // Reserve(payloadLength) (nullptr if it has none; a later call replaces the space handed
+  // out before) and takes it with Commit. Returns
+  // false, having changed nothing, if the sink had no room. Must be called with the
+  // engine's mutex held.
+  template <typename Sink>
+  bool ExecuteRequest(Napi::Env env, const wire::Request& request, Sink& sink);
+  template <typename Sink>
+  bool ExecuteGet(Napi::Env env, const StoreKey& key, Sink& sink);
+  // Stores value, decoded from a request, under key; must be called with the engine's
+  // mutex held
+  void StoreDecoded(const StoreKey& key, EntryValue&& value, size_t valueBytes, const SetOptions& options);
+  // Tombstone bookkeeping; must be called with the engine's mutex held. A maxAgeMs of 0
+  // keeps the tombstone until the key is set or deleted.
+  bool KnownMissing(const StoreKey& key);
+  void RememberMissing(const StoreKey& key, uint64_t maxAgeMs);
+  void ForgetMissing(const StoreKey& key);
+
   Napi::Value Set(const Napi::CallbackInfo& info);
   Napi::Value Get(const Napi::CallbackInfo& info);
+  Napi::Value GetOrLoad(const Napi::CallbackInfo& info);
+  Napi::Value Load(const Napi::CallbackInfo& info);
+  Napi::Value LoadMany(const Napi::CallbackInfo& info);
+  Napi::Value MGet(const Napi::CallbackInfo& info);
+  Napi::Value SetMissing(const Napi::CallbackInfo& info);
+  Napi::Value Update(const Napi::CallbackInfo& info);
+  Napi::Value GetWithVersion(const Napi::CallbackInfo& info);
+  Napi::Value GetIfChanged(const Napi::CallbackInfo& info);
+  // getWithVersion(), or with conditional getIfChanged(), which returns info[2] instead of
+  // the value if the entry is still at the version in info[1]
+  Napi::Value ReadVersioned(const Napi::CallbackInfo& info, bool conditional);
+  Napi::Value SetIfVersion(const Napi::CallbackInfo& info);
+  Napi::Value DeleteIfVersion(const Napi::CallbackInfo& info);
+  Napi::Value Transaction(const Napi::CallbackInfo& info);
+  static Napi::Value ShardOf(const Napi::CallbackInfo& info);
+  Napi::Value Incr(const Napi::CallbackInfo& info);
+  Napi::Value Decr(const Napi::CallbackInfo& info);
+  Napi::Value IncrByFloat(const Napi::CallbackInfo& info);
+  // Adds delta to the number stored under info[0], creating it from options.initial if
+  // missing; real allows a fractional delta and result
+  Napi::Value Increment(const Napi::CallbackInfo& info, double delta, bool real);
   Napi::Value Has(const Napi::CallbackInfo& info);
   Napi::Value Delete(const Napi::CallbackInfo& info);
+  Napi::Value DeleteAsync(const Napi::CallbackInfo& info);
   Napi::Value Clear(const Napi::CallbackInfo& info);
   Napi::Value Size(const Napi::CallbackInfo& info);
   Napi::Value Keys(const Napi::CallbackInfo& info);
@@ -83,25 +969,56 @@ private:
   Napi::Value StopCleanupTask(const Napi::CallbackInfo& info);
   Napi::Value CreateMutableKey(const Napi::CallbackInfo& info);
   Napi::Value All(const Napi::CallbackInfo& info);
+  Napi::Value Handle(const Napi::CallbackInfo& info);
+  Napi::Value Namespace(const Napi::CallbackInfo& info);
+  Napi::Value GetStats(const Napi::CallbackInfo& info);
+  Napi::Value LockStats(const Napi::CallbackInfo& info);
+  Napi::Value DrainRing(const Napi::CallbackInfo& info);
+  Napi::Value ExecuteBatch(const Napi::CallbackInfo& info);
+
+  // Options a namespace can set for itself: expectedSize, defaultMaxAgeMs, ttlJitter,
+  // earlyExpiryBeta, loader, batchLoader and negativeMaxAgeMs
+  void ApplyKeyspaceOptions(const Napi::Object& options);
+  // maxEntries and maxBytes; false if neither is set
+  static bool ReadLimits(const Napi::Object& options, Limits& limits);
 
-  void CleanupExpiredItems();
-  void CleanupWorker();
+  std::shared_ptr<Engine> engine;
+  // The keyspace this object is a view of
+  Keyspace* keyspace;
+};
 
-  std::unordered_map<std::string, StoreItem> store;
-  std::unordered_map<std::string, std::shared_ptr<KeyWrapper>> keyWrappers;
-  std::mutex storeMutex;
-  std::thread cleanupThread;
-  std::condition_variable cleanupCV;
-  std::atomic<bool> stopCleanup;
-  uint64_t cleanupIntervalMs;
+// Precompiled key: resolved and hashed once, with a cached pointer to its entry.
+// Handed to JS as an External, which is cheaper to recognise than a wrapped object.
+struct KeyHandle {
+  StoreKey key;
+  ValueRef keyRef; // Original key, used as the entry's keyRef
+  uint64_t seed = 0;
+  uint64_t keyspaceId = 0;
+  uint64_t slotGeneration = 0;
+  MemoryStore::Entry* slot = nullptr;
 };
 
 Napi::Object MemoryStore::Init(Napi::Env env, Napi::Object exports) {
   Napi::Function func = DefineClass(env, "MemoryStore", {
     InstanceMethod("set", &MemoryStore::Set),
     InstanceMethod("get", &MemoryStore::Get),
+    InstanceMethod("getOrLoad", &MemoryStore::GetOrLoad),
+    InstanceMethod("load", &MemoryStore::Load),
+    InstanceMethod("loadMany", &MemoryStore::LoadMany),
+    InstanceMethod("mget", &MemoryStore::MGet),
+    InstanceMethod("setMissing", &MemoryStore::SetMissing),
+    InstanceMethod("update", &MemoryStore::Update),
+    InstanceMethod("getWithVersion", &MemoryStore::GetWithVersion),
+    InstanceMethod("getIfChanged", &MemoryStore::GetIfChanged),
+    InstanceMethod("setIfVersion", &MemoryStore::SetIfVersion),
+    InstanceMethod("deleteIfVersion", &MemoryStore::DeleteIfVersion),
+    InstanceMethod("transaction", &MemoryStore::Transaction),
+    InstanceMethod("incr", &MemoryStore::Incr),
+    InstanceMethod("decr", &MemoryStore::Decr),
+    InstanceMethod("incrByFloat", &MemoryStore::IncrByFloat),
     InstanceMethod("has", &MemoryStore::Has),
     InstanceMethod("delete", &MemoryStore::Delete),
+    InstanceMethod("deleteAsync", &MemoryStore::DeleteAsync),
     InstanceMethod("clear", &MemoryStore::Clear),
     InstanceMethod("size", &MemoryStore::Size),
     InstanceMethod("keys", &MemoryStore::Keys),
@@ -109,36 +1026,143 @@ Napi::Object MemoryStore::Init(Napi::Env env, Napi::Object exports) {
     InstanceMethod("startCleanupTask", &MemoryStore::StartCleanupTask),
     InstanceMethod("stopCleanupTask", &MemoryStore::StopCleanupTask),
     InstanceMethod("createMutableKey", &MemoryStore::CreateMutableKey),
-    InstanceMethod("all", &MemoryStore::All)
+    InstanceMethod("all", &MemoryStore::All),
+    InstanceMethod("handle", &MemoryStore::Handle),
+    InstanceMethod("namespace", &MemoryStore::Namespace),
+    InstanceMethod("stats", &MemoryStore::GetStats),
+    InstanceMethod("lockStats", &MemoryStore::LockStats),
+    InstanceMethod("drainRing", &MemoryStore::DrainRing),
+    InstanceMethod("executeBatch", &MemoryStore::ExecuteBatch),
+    StaticMethod("shardOf", &MemoryStore::ShardOf)
   });
 
-  Napi::FunctionReference* constructor = new Napi::FunctionReference();
-  *constructor = Napi::Persistent(func);
-  env.SetInstanceData(constructor);
+  AddonData* data = new AddonData();
+  data->memoryStoreConstructor = Napi::Persistent(func);
+  env.SetInstanceData(data);
 
   exports.Set("MemoryStore", func);
   return exports;
 }
 
 MemoryStore::MemoryStore(const Napi::CallbackInfo& info) 
-  : Napi::ObjectWrap<MemoryStore>(info), stopCleanup(true), cleanupIntervalMs(60000) {
+  : Napi::ObjectWrap<MemoryStore>(info), keyspace(nullptr) {
   Napi::Env env = info.Env();
 
+  // A namespace view shares its parent's engine
+  AddonData* data = env.GetInstanceData<AddonData>();
+  if (data->pendingView != nullptr) {
+    ViewInit* view = static_cast<ViewInit*>(data->pendingView);
+    data->pendingView = nullptr;
+    engine = view->engine;
+    keyspace = view->keyspace;
+    return;
+  }
+
+  engine = std::make_shared<Engine>(env);
+  {
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    keyspace = engine->GetKeyspace("");
+  }
+
   if (info.Length() > 0 && info[0].IsObject()) {
     Napi::Object options = info[0].As<Napi::Object>();
     
     if (options.Has("cleanupInterval") && options.Get("cleanupInterval").IsNumber()) {
-      cleanupIntervalMs = options.Get("cleanupInterval").As<Napi::Number>().Uint32Value();
+      engine->cleanupIntervalMs = options.Get("cleanupInterval").As<Napi::Number>().Uint32Value();
+    }
+    
+    ApplyKeyspaceOptions(options);
+    // A store's own limits are the budget shared with its namespaces
+    ReadLimits(options, engine->budget);
+    
+    if (options.Has("keyPrefixDelimiter") && options.Get("keyPrefixDelimiter").IsString()) {
+      std::string delimiter = options.Get("keyPrefixDelimiter").As<Napi::String>().Utf8Value();
+      if (delimiter.size() != 1) {
+        Napi::TypeError::New(env, "keyPrefixDelimiter must be a single character").ThrowAsJavaScriptException();
+        return;
+      }
+      engine->keyPrefixDelimiter = delimiter[0];
+      keyspace->keyPrefixes.Enable(delimiter[0], engine->hashSeed);
+    }
+    
+    if (options.Has("objectKeys") && options.Get("objectKeys").IsString()) {
+      std::string mode = options.Get("objectKeys").As<Napi::String>().Utf8Value();
+      if (mode == "identity") {
+        engine->objectKeyMode = ObjectKeyMode::Identity;
+      } else if (mode == "structural") {
+        engine->objectKeyMode = ObjectKeyMode::Structural;
+      } else if (mode != "json") {
+        Napi::TypeError::New(env, "objectKeys must be 'json', 'identity' or 'structural'").ThrowAsJavaScriptException();
+        return;
+      }
     }
   }
 }
 
-MemoryStore::~MemoryStore() {
-  stopCleanup = true;
-  cleanupCV.notify_one();
+MemoryStore::Engine::Engine(Napi::Env env)
+  : graveyard(std::make_shared<Graveyard>()), hashSeed(keyhash::RandomSeed(nextKeyspaceId.load())) {
+  graveyard->OpenSignal(env);
+}
+
+MemoryStore::Engine::~Engine() {
+  StopCleanup();
+  graveyard->CloseSignal();
+}
+
+MemoryStore::Keyspace* MemoryStore::Engine::GetKeyspace(const std::string& name) {
+  auto& keyspace = keyspaces[name];
+  if (!keyspace) {
+    keyspace = std::make_unique<Keyspace>();
+    if (keyPrefixDelimiter != 0) {
+      keyspace->keyPrefixes.Enable(keyPrefixDelimiter, hashSeed);
+    }
+  }
+  return keyspace.get();
+}
+
+bool MemoryStore::ReadLimits(const Napi::Object& options, Limits& limits) {
+  bool found = false;
+  if (options.Has("maxEntries") && options.Get("maxEntries").IsNumber()) {
+    limits.maxEntries = static_cast<size_t>(options.Get("maxEntries").As<Napi::Number>().DoubleValue());
+    found = true;
+  }
+  if (options.Has("maxBytes") && options.Get("maxBytes").IsNumber()) {
+    limits.maxBytes = static_cast<size_t>(options.Get("maxBytes").As<Napi::Number>().DoubleValue());
+    found = true;
+  }
+  return found;
+}
+
+void MemoryStore::ApplyKeyspaceOptions(const Napi::Object& options) {
+  // Sizing the table up front avoids resizing while it fills
+  if (options.Has("expectedSize") && options.Get("expectedSize").IsNumber()) {
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    keyspace->expectedSize = options.Get("expectedSize").As<Napi::Number>().Uint32Value();
+    keyspace->table.Reserve(keyspace->expectedSize);
+  }
   
-  if (cleanupThread.joinable()) {
-    cleanupThread.join();
+  if (options.Has("defaultMaxAgeMs") && options.Get("defaultMaxAgeMs").IsNumber()) {
+    keyspace->defaultMaxAgeMs = options.Get("defaultMaxAgeMs").As<Napi::Number>().Uint32Value();
+  }
+  
+  if (options.Has("ttlJitter") && options.Get("ttlJitter").IsNumber()) {
+    keyspace->ttlJitter = options.Get("ttlJitter").As<Napi::Number>().DoubleValue();
+  }
+  
+  if (options.Has("earlyExpiryBeta") && options.Get("earlyExpiryBeta").IsNumber()) {
+    keyspace->earlyExpiryBeta = options.Get("earlyExpiryBeta").As<Napi::Number>().DoubleValue();
+  }
+  
+  if (options.Has("loader") && options.Get("loader").IsFunction()) {
+    keyspace->loader = Napi::Persistent(options.Get("loader").As<Napi::Function>());
+  }
+  
+  if (options.Has("batchLoader") && options.Get("batchLoader").IsFunction()) {
+    keyspace->batchLoader = Napi::Persistent(options.Get("batchLoader").As<Napi::Function>());
+  }
+  
+  if (options.Has("negativeMaxAgeMs") && options.Get("negativeMaxAgeMs").IsNumber()) {
+    keyspace->negativeMaxAgeMs = options.Get("negativeMaxAgeMs").As<Napi::Number>().Uint32Value();
   }
 }
 
@@ -163,8 +1187,8 @@ Napi::Value MemoryStore::CreateMutableKey(const Napi::CallbackInfo& info) {
 
   // Store in our map (thread-safe)
   {
-    std::lock_guard<std::mutex> lock(storeMutex);
-    keyWrappers[uniqueId] = keyWrapper;
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    engine->keyWrappers[uniqueId] = keyWrapper;
   }
 
   // Create the Proxy object in JavaScript
@@ -234,81 +1258,1914 @@ Napi::Value MemoryStore::CreateMutableKey(const Napi::CallbackInfo& info) {
   return proxyObject;
 }
 
-Napi::Value MemoryStore::Set(const Napi::CallbackInfo& info) {
-  Napi::Env env = info.Env();
+bool MemoryStore::ResolveKey(const Napi::Value& keyValue, StoreKey& key) {
+  switch (keyValue.Type()) {
+    case napi_string:
+      key = StoreKey::FromString(keyValue.As<Napi::String>().Utf8Value(), engine->hashSeed);
+      return true;
+    
+    case napi_object:
+    case napi_function:
+      return ResolveObjectKey(keyValue.As<Napi::Object>(), key);
+    
+    default:
+      // For other primitives
+      key = StoreKey::FromString(SafeGetString(keyValue), engine->hashSeed);
+      return true;
+  }
+}
+
+bool MemoryStore::ResolveObjectKey(const Napi::Object& keyObj, StoreKey& key) {
+  Napi::Env env = keyObj.Env();
+  
+  // Objects seen before already carry their id, so skip the mutable key check
+  if (engine->objectKeyMode == ObjectKeyMode::Identity) {
+    void* tag = nullptr;
+    AddonData* data = env.GetInstanceData<AddonData>();
+    if (napi_unwrap(env, keyObj, &tag) == napi_ok && data->identityTags.count(static_cast<IdentityTag*>(tag)) > 0) {
+      key = StoreKey::Tagged(StoreKey::Identity, reinterpret_cast<const char*>(&static_cast<IdentityTag*>(tag)->id), sizeof(uint64_t), engine->hashSeed);
+      return true;
+    }
+  }
+  
+  // Buffers and typed arrays are keyed by their raw bytes
+  const char* bytes;
+  size_t length;
+  if (GetTypedArrayBytes(env, keyObj, bytes, length)) {
+    key = StoreKey::Tagged(StoreKey::Binary, bytes, length, engine->hashSeed);
+    return true;
+  }
+  
+  // Mutable keys are stored under their id
+  Napi::Value keyId = keyObj.Get("__keyId");
+  if (keyId.IsString()) {
+    key = StoreKey::FromString(keyId.As<Napi::String>().Utf8Value(), engine->hashSeed);
+    return true;
+  }
+  
+  switch (engine->objectKeyMode) {
+    case ObjectKeyMode::Identity:
+      return IdentityKey(keyObj, key);
+    
+    case ObjectKeyMode::Structural: {
+      std::string encoded;
+      if (!EncodeStructural(keyObj, encoded, 0)) {
+        return false;
+      }
+      key = StoreKey::Tagged(StoreKey::Structural, encoded, engine->hashSeed);
+      return true;
+    }
+    
+    default:
+      key = StoreKey::FromString(SafeGetString(keyObj), engine->hashSeed);
+      return !env.IsExceptionPending(); // JSON.stringify throws on cycles
+  }
+}
+
+bool MemoryStore::IdentityKey(const Napi::Object& keyObj, StoreKey& key) {
+  Napi::Env env = keyObj.Env();
+  AddonData* data = env.GetInstanceData<AddonData>();
+  
+  IdentityTag* tag = new IdentityTag{data->nextIdentityId++};
+  napi_status status = napi_wrap(env, keyObj, tag, [](napi_env env, void* finalizeData, void*) {
+    IdentityTag* tag = static_cast<IdentityTag*>(finalizeData);
+    AddonData* data = Napi::Env(env).GetInstanceData<AddonData>();
+    if (data != nullptr) {
+      data->identityTags.erase(tag);
+    }
+    delete tag;
+  }, nullptr, nullptr);
+  
+  if (status != napi_ok) {
+    // Already wrapped by other native code (for example another store)
+    delete tag;
+    Napi::TypeError::New(env, "Object cannot be used as an identity key").ThrowAsJavaScriptException();
+    return false;
+  }
+  
+  data->identityTags.insert(tag);
+  key = StoreKey::Tagged(StoreKey::Identity, reinterpret_cast<const char*>(&tag->id), sizeof(uint64_t), engine->hashSeed);
+  return true;
+}
+
+// Canonical encoding for structural keys: a type byte, then fixed-width numbers or
+// length-prefixed bytes. Object properties are sorted, so {a, b} and {b, a} are one key.
+bool MemoryStore::EncodeStructural(const Napi::Value& value, std::string& out, int depth) {
+  Napi::Env env = value.Env();
+  
+  auto appendLength = [&out](size_t length) {
+    uint32_t length32 = static_cast<uint32_t>(length);
+    out.append(reinterpret_cast<const char*>(&length32), sizeof(length32));
+  };
+  // Strings are read through a stack buffer first, saving the length query for short ones
+  auto appendString = [&env, &out, &appendLength](napi_value str) {
+    char buffer[128];
+    size_t length = 0;
+    napi_get_value_string_utf8(env, str, buffer, sizeof(buffer), &length);
+    if (length < sizeof(buffer) - 1) {
+      appendLength(length);
+      out.append(buffer, length);
+      return;
+    }
+    std::string utf8 = Napi::String(env, str).Utf8Value();
+    appendLength(utf8.size());
+    out.append(utf8);
+  };
+  
+  if (depth > 64) {
+    Napi::TypeError::New(env, "Structural key is nested too deeply or cyclic").ThrowAsJavaScriptException();
+    return false;
+  }
+  
+  switch (value.Type()) {
+    case napi_undefined:
+      out.push_back('u');
+      return true;
+    
+    case napi_null:
+      out.push_back('z');
+      return true;
+    
+    case napi_boolean:
+      out.push_back(value.As<Napi::Boolean>().Value() ? 't' : 'f');
+      return true;
+    
+    case napi_number: {
+      double number = value.As<Napi::Number>().DoubleValue();
+      // -0 and 0 are the same key, and so is every NaN
+      if (number == 0) {
+        number = 0;
+      } else if (std::isnan(number)) {
+        number = std::nan("");
+      }
+      out.push_back('n');
+      out.append(reinterpret_cast<const char*>(&number), sizeof(number));
+      return true;
+    }
+    
+    case napi_string:
+      out.push_back('s');
+      appendString(value);
+      return true;
+    
+    case napi_bigint:
+      out.push_back('b');
+      appendString(value.ToString());
+      return true;
+    
+    case napi_object: {
+      if (value.IsArray()) {
+        Napi::Array array = value.As<Napi::Array>();
+        uint32_t length = array.Length();
+        out.push_back('a');
+        appendLength(length);
+        for (uint32_t i = 0; i < length; i++) {
+          if (!EncodeStructural(array.Get(i), out, depth + 1)) {
+            return false;
+          }
+        }
+        return true;
+      }
+      
+      const char* bytes;
+      size_t length;
+      if (GetTypedArrayBytes(env, value, bytes, length)) {
+        out.push_back('x');
+        appendLength(length);
+        out.append(bytes, length);
+        return true;
+      }
+      
+      if (value.IsDate()) {
+        out.push_back('d');
+        double time = value.ToNumber().As<Napi::Number>().DoubleValue();
+        out.append(reinterpret_cast<const char*>(&time), sizeof(time));
+        return true;
+      }
+      
+      // Own enumerable string properties, in sorted order
+      Napi::Object obj = value.As<Napi::Object>();
+      napi_value namesValue;
+      if (napi_get_all_property_names(env, obj, napi_key_own_only,
+                                      static_cast<napi_key_filter>(napi_key_enumerable | napi_key_skip_symbols),
+                                      napi_key_numbers_to_strings, &namesValue) != napi_ok) {
+        return false;
+      }
+      
+      Napi::Array names(env, namesValue);
+      uint32_t count = names.Length();
+      out.push_back('o');
+      appendLength(count);
+      
+      // Encode each property separately, then emit them in name order
+      std::vector<std::string> properties(count);
+      for (uint32_t i = 0; i < count; i++) {
+        Napi::Value name = names.Get(i);
+        std::swap(out, properties[i]);
+        appendString(name);
+        bool encoded = EncodeStructural(obj.Get(name), out, depth + 1);
+        std::swap(out, properties[i]);
+        if (!encoded) {
+          return false;
+        }
+      }
+      // Length-prefixed names don't sort alphabetically, but the order is still canonical
+      std::sort(properties.begin(), properties.end());
+      for (const auto& property : properties) {
+        out.append(property);
+      }
+      return true;
+    }
+    
+    default:
+      Napi::TypeError::New(env, "Structural keys can only contain plain objects, arrays, dates and primitives").ThrowAsJavaScriptException();
+      return false;
+  }
+}
+
+KeyHandle* MemoryStore::AsKeyHandle(const Napi::Value& value) {
+  if (!value.IsExternal()) {
+    return nullptr;
+  }
+  
+  KeyHandle* handle = value.As<Napi::External<KeyHandle>>().Data();
+  AddonData* data = value.Env().GetInstanceData<AddonData>();
+  if (data->keyHandles.count(handle) == 0) {
+    return nullptr;
+  }
+  return handle;
+}
+
+const StoreKey* MemoryStore::LookupKey(const Napi::Value& keyValue, KeyHandle*& handle, StoreKey& scratch) {
+  handle = AsKeyHandle(keyValue);
+  if (handle != nullptr) {
+    if (handle->seed != engine->hashSeed) {
+      // Hashed with another store's seed
+      scratch = handle->key.Rehashed(engine->hashSeed);
+      return &scratch;
+    }
+    return &handle->key; // Already resolved and hashed
+  }
+  
+  return ResolveKey(keyValue, scratch) ? &scratch : nullptr;
+}
+
+MemoryStore::Entry* MemoryStore::FindEntry(const StoreKey& key, KeyHandle* handle) {
+  bool ownHandle = handle != nullptr && handle->keyspaceId == keyspace->id;
+  
+  // Nothing was erased since the slot was cached, so it still points at the live entry.
+  // Resizing only relinks entries, so it never invalidates the pointer.
+  if (ownHandle && handle->slot != nullptr && handle->slotGeneration == keyspace->generation) {
+    return handle->slot;
+  }
+  
+  Entry* entry = keyspace->table.Find(key);
+  if (entry != nullptr && ownHandle) {
+    handle->slot = entry;
+    handle->slotGeneration = keyspace->generation;
+  }
+  return entry;
+}
+
+MemoryStore::Lookup MemoryStore::LookupConcurrent(const StoreKey& key, KeyHandle* handle, Entry*& entry) {
+  bool ownHandle = handle != nullptr && handle->keyspaceId == keyspace->id;
+  uint64_t sequence = keyspace->sequence.load(std::memory_order_acquire);
+  uint64_t generation = keyspace->generation.load(std::memory_order_acquire);
+  // Tombstones are only ever added on this thread, so if there are none now there won't
+  // be any before this returns
+  bool noTombstones = keyspace->missing.SizeConcurrent() == 0;
+  
+  if (ownHandle && handle->slot != nullptr && handle->slotGeneration == generation) {
+    entry = handle->slot;
+  } else {
+    entry = keyspace->table.FindConcurrent(key);
+    if (entry == nullptr) {
+      // The lookup may have missed an entry by racing with the cleanup thread's unlinking,
+      // but only if that happened while it ran
+      std::atomic_thread_fence(std::memory_order_acquire);
+      bool settled = sequence % 2 == 0 && keyspace->sequence.load(std::memory_order_relaxed) == sequence;
+      return settled && noTombstones ? Lookup::Missing : Lookup::Unsure;
+    }
+    if (ownHandle) {
+      handle->slot = entry;
+      handle->slotGeneration = generation;
+    }
+  }
+  
+  const StoreItem& item = entry->value;
+  auto never = std::chrono::steady_clock::time_point::max();
+  if (item.expiresAt == never && item.refreshAt == never) {
+    return Lookup::Fresh;
+  }
+  
+  // An expired entry is reclaimed by the locked path, after which the key is a plain miss
+  auto now = std::chrono::steady_clock::now();
+  if (item.Expired(now)) {
+    return Lookup::Unsure;
+  }
+  // Entries that may need reloading or an early expiration roll are left to the locked path
+  if (now >= item.refreshAt || (item.earlyExpiryBeta > 0 && item.computeMs > 0)) {
+    return Lookup::Unsure;
+  }
+  return Lookup::Fresh;
+}
+
+void MemoryStore::InsertOrAssign(const StoreKey& key, StoreItem&& item, bool enforceLimits) {
+  ForgetMissing(key);
+  keyspace->keyPrefixes.Sweep();
+  Entry* entry = keyspace->table.Find(key);
+  if (entry != nullptr) {
+    engine->Account(*keyspace, 0, static_cast<ptrdiff_t>(item.bytes) - static_cast<ptrdiff_t>(entry->value.bytes));
+    entry->value = std::move(item);
+    entry->value.referenced = true;
+  } else {
+    engine->Account(*keyspace, 1, static_cast<ptrdiff_t>(item.bytes));
+    keyspace->table.Insert(keyspace->keyPrefixes.Intern(key), std::move(item));
+  }
+  if (enforceLimits) {
+    engine->EnforceLimits(*keyspace);
+  }
+}
+
+bool MemoryStore::KnownMissing(const StoreKey& key) {
+  if (keyspace->missing.Size() == 0) {
+    return false;
+  }
+  TombstoneTable::Node* tombstone = keyspace->missing.Find(key);
+  if (tombstone == nullptr) {
+    return false;
+  }
+  if (std::chrono::steady_clock::now() >= tombstone->value.expiresAt) {
+    keyspace->missing.Erase(tombstone);
+    return false;
+  }
+  keyspace->stats.negativeHits++;
+  return true;
+}
+
+void MemoryStore::RememberMissing(const StoreKey& key, uint64_t maxAgeMs) {
+  auto expiresAt = std::chrono::steady_clock::time_point::max();
+  if (maxAgeMs > 0) {
+    expiresAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(maxAgeMs);
+  }
+  TombstoneTable::Node* tombstone = keyspace->missing.Find(key);
+  if (tombstone != nullptr) {
+    tombstone->value.expiresAt = expiresAt;
+  } else {
+    keyspace->missing.Insert(key, Tombstone{expiresAt});
+  }
+}
+
+void MemoryStore::ForgetMissing(const StoreKey& key) {
+  if (keyspace->missing.Size() == 0) {
+    return;
+  }
+  TombstoneTable::Node* tombstone = keyspace->missing.Find(key);
+  if (tombstone != nullptr) {
+    keyspace->missing.Erase(tombstone);
+  }
+}
+
+void MemoryStore::Engine::Account(Keyspace& keyspace, ptrdiff_t entries, ptrdiff_t bytes) {
+  keyspace.bytes += bytes;
+  totalEntries += entries;
+  totalBytes += bytes;
+}
+
+void MemoryStore::Engine::Erase(Keyspace& keyspace, Entry* entry) {
+  Account(keyspace, -1, -static_cast<ptrdiff_t>(entry->value.bytes));
+  keyspace.keyPrefixes.Release(entry->key);
+  keyspace.table.Erase(entry);
+  keyspace.generation++;
+}
+
+MemoryStore::Entry* MemoryStore::Engine::Detach(Keyspace& keyspace, Entry* entry) {
+  Account(keyspace, -1, -static_cast<ptrdiff_t>(entry->value.bytes));
+  keyspace.keyPrefixes.Release(entry->key);
+  keyspace.generation++;
+  return keyspace.table.Unlink(entry);
+}
+
+void MemoryStore::Engine::EnforceLimits(Keyspace& keyspace) {
+  // A keyspace over its own quota only ever evicts its own entries
+  while (keyspace.table.Size() > 0 && keyspace.quota.Exceeded(keyspace.table.Size(), keyspace.bytes)) {
+    EvictOne(keyspace);
+  }
+  
+  while (budget.Exceeded(totalEntries, totalBytes)) {
+    Keyspace* victim = PickVictim();
+    if (victim == nullptr) {
+      break;
+    }
+    EvictOne(*victim);
+  }
+}
+
+void MemoryStore::Engine::EvictOne(Keyspace& keyspace) {
+  // Expired entries go before any live one. Finding them all takes a pass over the
+  // keyspace, so it is only done again after half a keyspace's worth of evictions.
+  if (keyspace.evictionsUntilSweep == 0) {
+    keyspace.evictionsUntilSweep = std::max<size_t>(keyspace.table.Size() / 2, 64);
+    if (EraseExpired(keyspace) > 0) {
+      return;
+    }
+  }
+  keyspace.evictionsUntilSweep--;
+  
+  // Expired entries the hand passes on the way get no second chance
+  auto now = std::chrono::steady_clock::now();
+  Entry* victim = keyspace.table.Oldest();
+  while (victim->value.referenced && !victim->value.Expired(now)) {
+    victim->value.referenced = false;
+    keyspace.table.MoveToNewest(victim);
+    victim = keyspace.table.Oldest();
+  }
+  bool expired = victim->value.Expired(now);
+  Erase(keyspace, victim);
+  (expired ? keyspace.stats.expired : keyspace.stats.evicted)++;
+}
+
+size_t MemoryStore::Engine::EraseExpired(Keyspace& keyspace) {
+  auto now = std::chrono::steady_clock::now();
+  size_t erased = keyspace.table.EraseIf([&](Entry& entry) {
+    if (!entry.value.Expired(now)) {
+      return false;
+    }
+    Account(keyspace, -1, -static_cast<ptrdiff_t>(entry.value.bytes));
+    keyspace.keyPrefixes.Release(entry.key);
+    return true;
+  });
+  if (erased > 0) {
+    keyspace.generation++;
+    keyspace.stats.expired += erased;
+  }
+  return erased;
+}
+
+// Over budget, the keyspace using the most of its allowance pays first: its quota if it
+// has one, otherwise an equal share of the budget. A tenant that stays within its
+// share never loses entries to a larger one.
+MemoryStore::Keyspace* MemoryStore::Engine::PickVictim() {
+  bool byBytes = budget.maxBytes > 0 && totalBytes > budget.maxBytes;
+  size_t share = (byBytes ? budget.maxBytes : budget.maxEntries) / keyspaces.size();
+  
+  Keyspace* victim = nullptr;
+  double worst = 0;
+  for (auto& pair : keyspaces) {
+    Keyspace& keyspace = *pair.second;
+    if (keyspace.table.Size() == 0) {
+      continue;
+    }
+    size_t used = byBytes ? keyspace.bytes : keyspace.table.Size();
+    size_t allowance = byBytes ? keyspace.quota.maxBytes : keyspace.quota.maxEntries;
+    if (allowance == 0) {
+      allowance = share > 0 ? share : 1;
+    }
+    double ratio = static_cast<double>(used) / static_cast<double>(allowance);
+    if (ratio > worst) {
+      worst = ratio;
+      victim = &keyspace;
+    }
+  }
+  return victim;
+}
+
+void MemoryStore::Graveyard::Bury(std::unique_ptr<StoreTable> table) {
+  std::lock_guard<std::mutex> lock(mutex);
+  batches.push_back(Batch{std::move(table), nullptr, nullptr});
+}
+
+void MemoryStore::Graveyard::Bury(Entry* entries, std::unique_ptr<Napi::Promise::Deferred> done) {
+  std::lock_guard<std::mutex> lock(mutex);
+  batches.push_back(Batch{nullptr, entries, std::move(done)});
+}
+
+void MemoryStore::Graveyard::Schedule(Napi::Env env) {
+  if (scheduled) {
+    return;
+  }
+  scheduled = true;
+  
+  // The callback keeps the graveyard alive even if the store is collected first
+  Napi::Function drain = Napi::Function::New(env, [self = shared_from_this()](const Napi::CallbackInfo& info) {
+    self->DrainStep(info.Env());
+  }, "drainGraveyard");
+  // Node still delivers pending signals while tearing the environment down, when no JS can
+  // run any more; whatever is left is reclaimed with the process
+  if (drain.IsEmpty()) {
+    return;
+  }
+  Napi::Function setImmediate = env.Global().Get("setImmediate").As<Napi::Function>();
+  setImmediate.Call({drain});
+}
+
+void MemoryStore::Graveyard::OpenSignal(Napi::Env env) {
+  std::lock_guard<std::mutex> lock(signalMutex);
+  // The finalizer runs once the signal is released or when Node closes it at teardown,
+  // and holds the graveyard alive until then
+  signal = Napi::ThreadSafeFunction::New(env, Napi::Function(), "MemoryStoreCleanup", 0, 1,
+    new std::shared_ptr<Graveyard>(shared_from_this()), [](Napi::Env, std::shared_ptr<Graveyard>* self) {
+      {
+        std::lock_guard<std::mutex> lock((*self)->signalMutex);
+        (*self)->signalOpen = false;
+      }
+      delete self;
+    });
+  // Unref'd so a store with nothing left to release never keeps the process alive
+  signal.Unref(env);
+  signalOpen = true;
+}
+
+void MemoryStore::Graveyard::CloseSignal() {
+  std::lock_guard<std::mutex> lock(signalMutex);
+  if (signalOpen) {
+    signalOpen = false;
+    signal.Release();
+  }
+}
+
+void MemoryStore::Graveyard::Signal() {
+  std::lock_guard<std::mutex> lock(signalMutex);
+  if (signalOpen) {
+    signal.NonBlockingCall([self = shared_from_this()](Napi::Env env, Napi::Function) {
+      self->Schedule(env);
+    });
+  }
+}
+
+void MemoryStore::Graveyard::DrainStep(Napi::Env env) {
+  // Entries released per slice, and how long one tick may spend releasing them
+  const size_t kSliceEntries = 1024;
+  const auto kTickBudget = std::chrono::milliseconds(2);
+  
+  scheduled = false;
+  auto deadline = std::chrono::steady_clock::now() + kTickBudget;
+  std::vector<std::unique_ptr<Napi::Promise::Deferred>> finished;
+  bool more;
+  
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    while (!batches.empty()) {
+      Batch& batch = batches.front();
+      if (batch.table != nullptr) {
+        batch.table->DrainSome(kSliceEntries);
+      }
+      for (size_t i = 0; i < kSliceEntries && batch.entries != nullptr; i++) {
+        Entry* entry = batch.entries;
+        batch.entries = entry->next;
+        delete entry;
+      }
+      
+      if (batch.entries == nullptr && (batch.table == nullptr || batch.table->Size() == 0)) {
+        if (batch.done != nullptr) {
+          finished.push_back(std::move(batch.done));
+        }
+        batches.pop_front();
+      }
+      if (std::chrono::steady_clock::now() >= deadline) {
+        break;
+      }
+    }
+    more = !batches.empty();
+  }
+  
+  for (auto& done : finished) {
+    done->Resolve(Napi::Boolean::New(env, true));
+  }
+  if (more) {
+    Schedule(env);
+  }
+}
+
+Napi::Value MemoryStore::Handle(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Key is required").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  // Handles are already resolved
+  if (AsKeyHandle(info[0]) != nullptr) {
+    return info[0];
+  }
+
+  StoreKey key;
+  if (!ResolveKey(info[0], key)) {
+    return env.Null();
+  }
+
+  KeyHandle* handle = new KeyHandle();
+  handle->key = std::move(key);
+  handle->keyRef.Reset(info[0]);
+  handle->seed = engine->hashSeed;
+  handle->keyspaceId = keyspace->id;
+  
+  {
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    FindEntry(handle->key, handle);
+  }
+  
+  AddonData* data = env.GetInstanceData<AddonData>();
+  data->keyHandles.insert(handle);
+  
+  return Napi::External<KeyHandle>::New(env, handle, [](Napi::Env env, KeyHandle* handle) {
+    AddonData* data = env.GetInstanceData<AddonData>();
+    if (data != nullptr) {
+      data->keyHandles.erase(handle);
+    }
+    delete handle;
+  });
+}
+
+MemoryStore::SetOptions MemoryStore::DefaultSetOptions() const {
+  // Keyspaces can give entries a default lifetime; without one they are permanent
+  SetOptions options;
+  options.isPermanent = keyspace->defaultMaxAgeMs == 0;
+  options.maxAgeMs = keyspace->defaultMaxAgeMs;
+  options.ttlJitter = keyspace->ttlJitter;
+  options.earlyExpiryBeta = keyspace->earlyExpiryBeta;
+  return options;
+}
+
+MemoryStore::SetOptions MemoryStore::ReadSetOptions(const Napi::Value& value) const {
+  SetOptions options = DefaultSetOptions();
+
+  if (value.IsObject()) {
+    Napi::Object object = value.As<Napi::Object>();
+    
+    if (object.Has("isPermanent") && object.Get("isPermanent").IsBoolean()) {
+      options.isPermanent = object.Get("isPermanent").As<Napi::Boolean>().Value();
+    }
+    
+    if (object.Has("maxAgeMs") && object.Get("maxAgeMs").IsNumber()) {
+      options.maxAgeMs = object.Get("maxAgeMs").As<Napi::Number>().Uint32Value();
+    }
+    
+    if (object.Has("staleAfterMs") && object.Get("staleAfterMs").IsNumber()) {
+      options.staleAfterMs = object.Get("staleAfterMs").As<Napi::Number>().Uint32Value();
+    }
+    
+    if (object.Has("refreshAheadMs") && object.Get("refreshAheadMs").IsNumber()) {
+      options.refreshAheadMs = object.Get("refreshAheadMs").As<Napi::Number>().Uint32Value();
+    }
+    
+    if (object.Has("ttlJitter") && object.Get("ttlJitter").IsNumber()) {
+      options.ttlJitter = object.Get("ttlJitter").As<Napi::Number>().DoubleValue();
+    }
+    
+    if (object.Has("computeMs") && object.Get("computeMs").IsNumber()) {
+      options.computeMs = object.Get("computeMs").As<Napi::Number>().Uint32Value();
+    }
+    
+    if (object.Has("earlyExpiryBeta") && object.Get("earlyExpiryBeta").IsNumber()) {
+      options.earlyExpiryBeta = object.Get("earlyExpiryBeta").As<Napi::Number>().DoubleValue();
+    }
+    
+    // Callers know better than the estimate what an object costs
+    if (object.Has("size") && object.Get("size").IsNumber()) {
+      options.valueBytes = static_cast<size_t>(object.Get("size").As<Napi::Number>().DoubleValue());
+      options.sized = true;
+    }
+  }
+  return options;
+}
+
+MemoryStore::SetOptions MemoryStore::ReadCounterOptions(const Napi::Value& value) const {
+  SetOptions options = ReadSetOptions(value);
+  // The point of giving a counter a lifetime is for it to start over, so unlike set,
+  // maxAgeMs doesn't also need isPermanent: false
+  if (value.IsObject()) {
+    Napi::Object object = value.As<Napi::Object>();
+    if (!object.Get("isPermanent").IsBoolean() && object.Get("maxAgeMs").IsNumber() && options.maxAgeMs > 0) {
+      options.isPermanent = false;
+    }
+  }
+  return options;
+}
+
+void MemoryStore::ApplyOptions(StoreItem& item, const SetOptions& options) {
+  auto never = std::chrono::steady_clock::time_point::max();
+  auto now = options.maxAgeMs > 0 || options.staleAfterMs > 0 ? std::chrono::steady_clock::now() : never;
+  auto expiresAt = never;
+  if (!options.isPermanent && options.maxAgeMs > 0) {
+    // Jitter only ever shortens the lifetime, so entries written together expire spread out
+    // rather than all in the same cleanup tick
+    double lifetimeMs = static_cast<double>(options.maxAgeMs);
+    if (options.ttlJitter > 0) {
+      lifetimeMs -= lifetimeMs * std::min(options.ttlJitter, 1.0) * RandomUnit();
+    }
+    expiresAt = now + std::chrono::microseconds(static_cast<int64_t>(lifetimeMs * 1000));
+  }
+  
+  // The soft deadline is whichever comes first: staleAfterMs after the write, or
+  // refreshAheadMs before the entry expires
+  auto refreshAt = never;
+  if (options.staleAfterMs > 0) {
+    refreshAt = now + std::chrono::milliseconds(options.staleAfterMs);
+  }
+  if (options.refreshAheadMs > 0 && expiresAt != never) {
+    refreshAt = std::min(refreshAt, std::max(now, expiresAt - std::chrono::milliseconds(options.refreshAheadMs)));
+  }
+  
+  item.isPermanent = options.isPermanent;
+  item.maxAgeMs = options.maxAgeMs;
+  item.expiresAt = expiresAt;
+  item.refreshAt = refreshAt;
+  item.staleAfterMs = options.staleAfterMs;
+  item.refreshAheadMs = options.refreshAheadMs;
+  item.ttlJitter = static_cast<float>(options.ttlJitter);
+  item.computeMs = options.computeMs;
+  item.earlyExpiryBeta = static_cast<float>(options.earlyExpiryBeta);
+}
+
+void MemoryStore::StoreValue(const StoreKey& key, KeyHandle* handle, const Napi::Value& keyRef,
+                             const Napi::Value& value, const SetOptions& options) {
+  size_t valueBytes = options.sized ? options.valueBytes : EstimateValueBytes(value.Env(), value);
+  size_t bytes = sizeof(Entry) + key.Length() + valueBytes;
+
+  if (handle != nullptr) {
+    // Overwrite the existing entry in place, keeping its key reference
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    Entry* entry = FindEntry(key, handle);
+    
+    if (entry != nullptr) {
+      Overwrite(entry->value, value, &options, bytes);
+      return;
+    }
+  }
+
+  StoreItem item;
+  item.value.Assign(value);
+  // Store reference to original key object
+  item.keyRef.Reset(keyRef);
+  ApplyOptions(item, options);
+  item.bytes = bytes;
+
+  std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+  RecordWrite(item);
+  InsertOrAssign(key, std::move(item));
+}
+
+uint64_t MemoryStore::StoreValueLocked(const StoreKey& key, Entry* entry, const Napi::Value& keyRef,
+                                       const Napi::Value& value, const SetOptions& options, size_t bytes) {
+  if (entry != nullptr) {
+    return Overwrite(entry->value, value, &options, bytes, false);
+  }
+  
+  StoreItem item;
+  item.value.Assign(value);
+  item.keyRef.Reset(keyRef);
+  ApplyOptions(item, options);
+  item.bytes = bytes;
+  RecordWrite(item);
+  uint64_t version = item.version;
+  InsertOrAssign(key, std::move(item), false);
+  return version;
+}
+
+uint64_t MemoryStore::Overwrite(StoreItem& item, const Napi::Value& value, const SetOptions* options, size_t bytes,
+                                bool enforceLimits) {
+  engine->Account(*keyspace, 0, static_cast<ptrdiff_t>(bytes) - static_cast<ptrdiff_t>(item.bytes));
+  item.value.Assign(value);
+  if (options != nullptr) {
+    ApplyOptions(item, *options);
+  }
+  item.bytes = bytes;
+  item.referenced = true;
+  RecordWrite(item);
+  uint64_t version = item.version;
+  if (enforceLimits) {
+    engine->EnforceLimits(*keyspace);
+  }
+  return version;
+}
+
+MemoryStore::Entry* MemoryStore::FindLive(const StoreKey& key, KeyHandle* handle, Freshness* freshness) {
+  Entry* entry = FindEntry(key, handle);
+  if (entry == nullptr) {
+    return nullptr;
+  }
+  
+  // Entries without deadlines are the common case, and never need the clock
+  const StoreItem& item = entry->value;
+  auto never = std::chrono::steady_clock::time_point::max();
+  if (item.expiresAt == never && item.refreshAt == never) {
+    if (freshness != nullptr) {
+      *freshness = Freshness::Fresh;
+    }
+    return entry;
+  }
+  
+  // Expired entries found under the lock are erased here and then, so they don't linger
+  // when the cleanup task isn't running
+  auto now = std::chrono::steady_clock::now();
+  if (item.Expired(now)) {
+    engine->Erase(*keyspace, entry);
+    keyspace->stats.expired++;
+    return nullptr;
+  }
+  if (freshness == nullptr) {
+    return entry;
+  }
+  
+  *freshness = now >= item.refreshAt ? Freshness::Stale : Freshness::Fresh;
+  // XFetch: each read expires the entry early with a probability that rises as expiry
+  // nears, and sooner for values that are slow to load, so one reader reloads it well
+  // before the crowd would all miss at once
+  if (*freshness == Freshness::Fresh && item.earlyExpiryBeta > 0 && item.computeMs > 0 && item.expiresAt != never) {
+    double leadMs = item.computeMs * item.earlyExpiryBeta * -std::log(1.0 - RandomUnit());
+    if (now + std::chrono::microseconds(static_cast<int64_t>(leadMs * 1000)) >= item.expiresAt) {
+      *freshness = Freshness::Expiring;
+      keyspace->stats.earlyExpired++;
+    }
+  }
+  return entry;
+}
+
+MemoryStore::SetOptions MemoryStore::ItemOptions(const StoreItem& item) {
+  SetOptions options;
+  options.isPermanent = item.isPermanent;
+  options.maxAgeMs = item.maxAgeMs;
+  options.staleAfterMs = item.staleAfterMs;
+  options.refreshAheadMs = item.refreshAheadMs;
+  options.ttlJitter = item.ttlJitter;
+  options.earlyExpiryBeta = item.earlyExpiryBeta;
+  return options;
+}
+
+Napi::Value MemoryStore::OriginalKey(Napi::Env env, const Entry& entry) {
+  if (!entry.value.keyRef.IsEmpty()) {
+    return entry.value.keyRef.Value();
+  }
+  if (entry.key.IsKind(StoreKey::Binary)) {
+    return Napi::Buffer<char>::Copy(env, entry.key.str.data() + 2, entry.key.str.size() - 2);
+  }
+  return Napi::String::New(env, entry.key.ToString());
+}
+
+Napi::Value MemoryStore::Set(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 2) {
+    Napi::TypeError::New(env, "Wrong number of arguments").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  Napi::Value keyValue = info[0];
+  SetOptions options = ReadSetOptions(info.Length() >= 3 ? info[2] : env.Undefined());
+
+  KeyHandle* handle;
+  StoreKey scratch;
+  const StoreKey* keyPtr = LookupKey(keyValue, handle, scratch);
+  if (keyPtr == nullptr) {
+    return env.Null();
+  }
+  
+  StoreValue(*keyPtr, handle, handle != nullptr ? handle->keyRef.Value() : keyValue, info[1], options);
+  return Napi::Boolean::New(env, true);
+}
+
+Napi::Value MemoryStore::ReadValue(Napi::Env env, const StoreKey& key, KeyHandle* handle, bool& missing, bool& reload,
+                                   Napi::Value& keyRef, SetOptions& options) {
+  // Read-through with a batch loader loads misses; any loader can reload stale entries
+  bool readThrough = !keyspace->batchLoader.IsEmpty();
+  bool canReload = readThrough || !keyspace->loader.IsEmpty();
+  missing = false;
+  reload = false;
+
+  Freshness freshness = Freshness::Fresh;
+  Entry* entry = FindLive(key, handle, &freshness);
+
+  // Without a loader to reload it, an entry picked for early expiration is a miss for
+  // this caller only, who is expected to reload and set it
+  if (entry == nullptr || (freshness == Freshness::Expiring && !canReload)) {
+    keyspace->stats.misses++;
+    missing = entry == nullptr && KnownMissing(key);
+    reload = readThrough && entry == nullptr && !missing;
+    return Napi::Value();
+  }
+
+  entry->value.referenced = true;
+  keyspace->stats.hits++;
+  if (freshness != Freshness::Fresh && canReload) {
+    reload = true;
+    keyRef = OriginalKey(env, *entry);
+    options = ItemOptions(entry->value);
+  }
+  return entry->value.value.Value(env);
+}
+
+Napi::Value MemoryStore::Get(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Key is required").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  KeyHandle* handle;
+  StoreKey scratch;
+  const StoreKey* keyPtr = LookupKey(info[0], handle, scratch);
+  if (keyPtr == nullptr) {
+    return env.Null();
+  }
+
+  // Fresh hits, most reads by far, and plain misses are answered without taking the lock
+  Entry* entry;
+  Lookup lookup = LookupConcurrent(*keyPtr, handle, entry);
+  if (lookup == Lookup::Fresh) {
+    entry->value.referenced = true;
+    keyspace->stats.hits++;
+    return entry->value.value.Value(env);
+  }
+  if (lookup == Lookup::Missing && keyspace->batchLoader.IsEmpty()) {
+    keyspace->stats.misses++;
+    return env.Undefined();
+  }
+
+  Napi::Value value;
+  bool missing;
+  bool reload;
+  Napi::Value keyRef;
+  SetOptions options;
+  {
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    value = ReadValue(env, *keyPtr, handle, missing, reload, keyRef, options);
+  }
+
+  // Stale values are still served while they are reloaded in the background
+  if (reload) {
+    bool stale = !value.IsEmpty();
+    if (!stale) {
+      keyRef = handle != nullptr ? handle->keyRef.Value() : info[0];
+      options = ReadSetOptions(env.Undefined());
+    }
+    LoadInBackground(env, *keyPtr, keyRef, keyspace->loader.IsEmpty() ? Napi::Function() : keyspace->loader.Value(),
+                     options, stale);
+  }
+  
+  // Callers that pass a second argument get it back for keys known to be missing, so
+  // they can tell those apart from keys that just aren't cached
+  if (value.IsEmpty()) {
+    return missing && info.Length() >= 2 ? info[1] : env.Undefined();
+  }
+  return value;
+}
+
+Napi::Value MemoryStore::MGet(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1 || !info[0].IsArray()) {
+    Napi::TypeError::New(env, "Keys must be an array").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  // Keys are resolved first, since that may call into JS, so all lookups share one lock
+  Napi::Array keys = info[0].As<Napi::Array>();
+  uint32_t count = keys.Length();
+  std::vector<Napi::Value> keyValues(count);
+  std::vector<KeyHandle*> handles(count);
+  std::vector<StoreKey> scratch(count);
+  std::vector<const StoreKey*> resolved(count);
+  for (uint32_t i = 0; i < count; i++) {
+    keyValues[i] = keys.Get(i);
+    resolved[i] = LookupKey(keyValues[i], handles[i], scratch[i]);
+    if (resolved[i] == nullptr) {
+      return env.Null();
+    }
+  }
+
+  Napi::Array values = Napi::Array::New(env, count);
+  std::vector<uint32_t> reloads;
+  std::vector<Napi::Value> reloadKeys(count);
+  std::vector<SetOptions> reloadOptions(count);
+  {
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    for (uint32_t i = 0; i < count; i++) {
+      bool missing;
+      bool reload;
+      Napi::Value value = ReadValue(env, *resolved[i], handles[i], missing, reload, reloadKeys[i], reloadOptions[i]);
+      if (value.IsEmpty()) {
+        value = missing && info.Length() >= 2 ? info[1] : env.Undefined();
+      }
+      values.Set(i, value);
+      if (reload) {
+        reloads.push_back(i);
+      }
+    }
+  }
+
+  // Misses all join the same batch
+  for (uint32_t i : reloads) {
+    bool stale = !reloadKeys[i].IsEmpty();
+    if (!stale) {
+      reloadKeys[i] = handles[i] != nullptr ? handles[i]->keyRef.Value() : keyValues[i];
+      reloadOptions[i] = ReadSetOptions(env.Undefined());
+    }
+    LoadInBackground(env, *resolved[i], reloadKeys[i], keyspace->loader.IsEmpty() ? Napi::Function() : keyspace->loader.Value(),
+                     reloadOptions[i], stale);
+  }
+  return values;
+}
+
+Napi::Value MemoryStore::SetMissing(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Key is required").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  KeyHandle* handle;
+  StoreKey scratch;
+  const StoreKey* keyPtr = LookupKey(info[0], handle, scratch);
+  if (keyPtr == nullptr) {
+    return env.Null();
+  }
+  
+  uint64_t ttlMs = keyspace->negativeMaxAgeMs;
+  if (info.Length() >= 2 && info[1].IsNumber()) {
+    ttlMs = info[1].As<Napi::Number>().Uint32Value();
+  }
+  
+  // The key's value, if any, is replaced by the tombstone
+  std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+  Entry* entry = FindEntry(*keyPtr, handle);
+  if (entry != nullptr) {
+    engine->Erase(*keyspace, entry);
+  }
+  RememberMissing(*keyPtr, ttlMs);
+  return Napi::Boolean::New(env, true);
+}
+
+Napi::Value MemoryStore::Update(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 2 || !info[1].IsFunction()) {
+    Napi::TypeError::New(env, "Key and update function are required").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  KeyHandle* handle;
+  StoreKey scratch;
+  const StoreKey* keyPtr = LookupKey(info[0], handle, scratch);
+  if (keyPtr == nullptr) {
+    return env.Null();
+  }
+  const StoreKey& key = *keyPtr;
+  
+  // Without options an existing entry keeps its lifetime
+  bool hasOptions = info.Length() >= 3 && info[2].IsObject();
+  SetOptions options = ReadSetOptions(hasOptions ? info[2] : env.Undefined());
+  
+  Entry* entry;
+  uint64_t generation;
+  Napi::Value current;
+  {
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    entry = FindLive(key, handle);
+    generation = keyspace->generation;
+    current = entry != nullptr ? entry->value.value.Value(env) : env.Undefined();
+  }
+  
+  // fn runs without the lock, since it may use the store itself
+  Napi::Value next = info[1].As<Napi::Function>().Call({current});
+  if (env.IsExceptionPending()) {
+    return env.Null();
+  }
+  size_t valueBytes = options.sized || next.IsUndefined() ? options.valueBytes : EstimateValueBytes(env, next);
+  
+  {
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    // Entries stay put until erased, so unless something was erased meanwhile the one
+    // found before is still the key's
+    if (keyspace->generation != generation) {
+      entry = FindLive(key, handle);
+    } else if (entry != nullptr && entry->value.Expired(std::chrono::steady_clock::now())) {
+      // fn ran past the entry's deadline; writing to it would keep that deadline, so the
+      // value goes into a fresh entry instead
+      engine->Erase(*keyspace, entry);
+      keyspace->stats.expired++;
+      entry = nullptr;
+    }
+    
+    // Returning undefined deletes the key, as storing it would only look like a miss
+    if (next.IsUndefined()) {
+      if (entry != nullptr) {
+        engine->Erase(*keyspace, entry);
+        keyspace->stats.deletes++;
+      }
+      return env.Undefined();
+    }
+    
+    if (entry != nullptr) {
+      Overwrite(entry->value, next, hasOptions ? &options : nullptr, sizeof(Entry) + key.Length() + valueBytes);
+      return next;
+    }
+  }
+  
+  options.sized = true;
+  options.valueBytes = valueBytes;
+  StoreValue(key, handle, handle != nullptr ? handle->keyRef.Value() : info[0], next, options);
+  return next;
+}
+
+Napi::Value MemoryStore::GetWithVersion(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Key is required").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  return ReadVersioned(info, false);
+}
+
+Napi::Value MemoryStore::GetIfChanged(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 2 || !info[1].IsNumber()) {
+    Napi::TypeError::New(env, "Key and known version are required").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  return ReadVersioned(info, true);
+}
+
+Napi::Value MemoryStore::ReadVersioned(const Napi::CallbackInfo& info, bool conditional) {
+  Napi::Env env = info.Env();
+
+  KeyHandle* handle;
+  StoreKey scratch;
+  const StoreKey* keyPtr = LookupKey(info[0], handle, scratch);
+  if (keyPtr == nullptr) {
+    return env.Null();
+  }
+  
+  Napi::Value value;
+  uint64_t version;
+  {
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    Entry* entry = FindLive(*keyPtr, handle);
+    if (entry == nullptr) {
+      keyspace->stats.misses++;
+      return env.Undefined();
+    }
+    entry->value.referenced = true;
+    keyspace->stats.hits++;
+    // An unchanged entry's value isn't even read, so nothing is handed back to JS for it
+    if (conditional && entry->value.version == static_cast<uint64_t>(info[1].As<Napi::Number>().DoubleValue())) {
+      keyspace->stats.unchanged++;
+      return info.Length() >= 3 ? info[2] : env.Null();
+    }
+    value = entry->value.value.Value(env);
+    version = entry->value.version;
+  }
+  
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("value", value);
+  result.Set("version", Napi::Number::New(env, static_cast<double>(version)));
+  return result;
+}
+
+Napi::Value MemoryStore::SetIfVersion(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 3 || !info[2].IsNumber()) {
+    Napi::TypeError::New(env, "Key, value and expected version are required").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  KeyHandle* handle;
+  StoreKey scratch;
+  const StoreKey* keyPtr = LookupKey(info[0], handle, scratch);
+  if (keyPtr == nullptr) {
+    return env.Null();
+  }
+  const StoreKey& key = *keyPtr;
+  
+  uint64_t expected = static_cast<uint64_t>(info[2].As<Napi::Number>().DoubleValue());
+  Napi::Value value = info[1];
+  SetOptions options = ReadSetOptions(info.Length() >= 4 ? info[3] : env.Undefined());
+  size_t valueBytes = options.sized ? options.valueBytes : EstimateValueBytes(env, value);
+  size_t bytes = sizeof(Entry) + key.Length() + valueBytes;
+  
+  // The check and the write happen under one lock, so nothing can slip in between
+  std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+  Entry* entry = FindLive(key, handle);
+  if ((entry != nullptr ? entry->value.version : 0) != expected) {
+    return Napi::Boolean::New(env, false);
+  }
+  
+  uint64_t version = StoreValueLocked(key, entry, handle != nullptr ? handle->keyRef.Value() : info[0],
+                                      value, options, bytes);
+  engine->EnforceLimits(*keyspace);
+  return Napi::Number::New(env, static_cast<double>(version));
+}
+
+Napi::Value MemoryStore::DeleteIfVersion(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 2 || !info[1].IsNumber()) {
+    Napi::TypeError::New(env, "Key and expected version are required").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  KeyHandle* handle;
+  StoreKey scratch;
+  const StoreKey* keyPtr = LookupKey(info[0], handle, scratch);
+  if (keyPtr == nullptr) {
+    return env.Null();
+  }
+  
+  uint64_t expected = static_cast<uint64_t>(info[1].As<Napi::Number>().DoubleValue());
+  std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+  Entry* entry = FindLive(*keyPtr, handle);
+  if (entry == nullptr || entry->value.version != expected) {
+    return Napi::Boolean::New(env, false);
+  }
+  
+  engine->Erase(*keyspace, entry);
+  keyspace->stats.deletes++;
+  return Napi::Boolean::New(env, true);
+}
+
+bool MemoryStore::ReadTransactionOp(Napi::Env env, const Napi::Value& spec, TransactionOp& op) {
+  if (!spec.IsObject() || !spec.As<Napi::Object>().Get("op").IsString()) {
+    Napi::TypeError::New(env, "Each operation must be an object with an op").ThrowAsJavaScriptException();
+    return false;
+  }
+  Napi::Object object = spec.As<Napi::Object>();
+  std::string name = object.Get("op").As<Napi::String>().Utf8Value();
+  
+  op.keyValue = object.Get("key");
+  op.key = LookupKey(op.keyValue, op.handle, op.scratch);
+  if (op.key == nullptr) {
+    return false;
+  }
+  
+  Napi::Value version = object.Get("version");
+  if (name == "set" || name == "setIfVersion") {
+    op.type = name == "set" ? TransactionOp::Type::Set : TransactionOp::Type::SetIfVersion;
+    op.value = object.Get("value");
+    op.options = ReadSetOptions(object.Get("options"));
+    op.bytes = sizeof(Entry) + op.key->Length() +
+               (op.options.sized ? op.options.valueBytes : EstimateValueBytes(env, op.value));
+  } else if (name == "delete" || name == "deleteIfVersion") {
+    op.type = name == "delete" ? TransactionOp::Type::Delete : TransactionOp::Type::DeleteIfVersion;
+  } else if (name == "incr" || name == "decr") {
+    op.type = TransactionOp::Type::Incr;
+    Napi::Value delta = object.Get("delta");
+    Napi::Value initial = object.Get("initial");
+    double deltaValue = delta.IsNumber() ? delta.As<Napi::Number>().DoubleValue() : 1;
+    double initialValue = initial.IsNumber() ? initial.As<Napi::Number>().DoubleValue() : 0;
+    if (std::trunc(deltaValue) != deltaValue || std::fabs(deltaValue) > 9007199254740991.0 ||
+        std::trunc(initialValue) != initialValue || std::fabs(initialValue) > 9007199254740991.0) {
+      Napi::TypeError::New(env, "Delta and initial value must be integers").ThrowAsJavaScriptException();
+      return false;
+    }
+    op.delta = static_cast<int64_t>(name == "incr" ? deltaValue : -deltaValue);
+    op.initial = static_cast<int64_t>(initialValue);
+    op.options = ReadCounterOptions(object.Get("options"));
+    op.bytes = sizeof(Entry) + op.key->Length() + (op.options.sized ? op.options.valueBytes : 8);
+  } else {
+    Napi::TypeError::New(env, "Unknown operation: " + name).ThrowAsJavaScriptException();
+    return false;
+  }
+  
+  if (op.type == TransactionOp::Type::SetIfVersion || op.type == TransactionOp::Type::DeleteIfVersion) {
+    if (!version.IsNumber()) {
+      Napi::TypeError::New(env, name + " requires a version").ThrowAsJavaScriptException();
+      return false;
+    }
+    op.version = static_cast<uint64_t>(version.As<Napi::Number>().DoubleValue());
+  }
+  return true;
+}
+
+Napi::Value MemoryStore::Transaction(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1 || !info[0].IsArray()) {
+    Napi::TypeError::New(env, "Operations must be an array").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  // Everything that may call into JS happens before the lock is taken
+  Napi::Array specs = info[0].As<Napi::Array>();
+  uint32_t count = specs.Length();
+  std::vector<TransactionOp> ops(count);
+  std::unordered_map<StoreKey, size_t, StoreKeyHash> slots;
+  for (uint32_t i = 0; i < count; i++) {
+    if (!ReadTransactionOp(env, specs.Get(i), ops[i])) {
+      return env.Null();
+    }
+    ops[i].slot = slots.emplace(*ops[i].key, i).first->second;
+  }
+  
+  // What the transaction has done to a key so far. A key it wrote has a version nobody
+  // could have read yet, so later version checks on it fail.
+  struct KeyState {
+    Entry* entry = nullptr; // The key's entry as validation found it
+    bool present = false;
+    bool written = false;
+    uint64_t version = 0;
+    EntryValue::Kind kind = EntryValue::Kind::Reference;
+    int64_t integer = 0;
+  };
+  
+  Napi::Array results = Napi::Array::New(env, count);
+  std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+  
+  // Every operation is checked against the state the ones before it leave behind, so
+  // either all of them apply or none do
+  std::vector<KeyState> states(count);
+  for (uint32_t i = 0; i < count; i++) {
+    TransactionOp& op = ops[i];
+    KeyState& state = states[op.slot];
+    if (op.slot == i) {
+      Entry* entry = FindLive(*op.key, op.handle);
+      if (entry != nullptr) {
+        state.entry = entry;
+        state.present = true;
+        state.version = entry->value.version;
+        state.kind = entry->value.value.GetKind();
+        state.integer = state.kind == EntryValue::Kind::Integer ? entry->value.value.Integer() : 0;
+      }
+    }
+    
+    uint64_t current = state.present ? state.version : 0;
+    switch (op.type) {
+      case TransactionOp::Type::SetIfVersion:
+        if ((state.present && state.written) || current != op.version) {
+          return Napi::Boolean::New(env, false);
+        }
+        [[fallthrough]];
+      case TransactionOp::Type::Set: {
+        EntryValue value;
+        if (op.value.IsNumber()) {
+          value.SetReal(op.value.As<Napi::Number>().DoubleValue());
+        }
+        state.present = true;
+        state.written = true;
+        state.kind = value.GetKind();
+        state.integer = state.kind == EntryValue::Kind::Integer ? value.Integer() : 0;
+        break;
+      }
+      case TransactionOp::Type::DeleteIfVersion:
+        if (!state.present || state.written || current != op.version) {
+          return Napi::Boolean::New(env, false);
+        }
+        [[fallthrough]];
+      case TransactionOp::Type::Delete:
+        state.present = false;
+        state.written = false;
+        break;
+      case TransactionOp::Type::Incr:
+        if (state.present && state.kind != EntryValue::Kind::Integer) {
+          Napi::TypeError::New(env, "Value is not an integer").ThrowAsJavaScriptException();
+          return env.Null();
+        }
+        if (!AddToCounter(state.present ? state.integer : op.initial, op.delta, state.integer)) {
+          Napi::RangeError::New(env, "Increment would overflow").ThrowAsJavaScriptException();
+          return env.Null();
+        }
+        state.present = true;
+        state.written = true;
+        state.kind = EntryValue::Kind::Integer;
+        break;
+    }
+  }
+  
+  // Operations apply to the entries validation found rather than looking keys up again,
+  // which could find an entry that expired since and disagree with what was checked.
+  // Nothing is evicted until every operation has applied, so those entries stay put.
+  for (uint32_t i = 0; i < count; i++) {
+    TransactionOp& op = ops[i];
+    KeyState& state = states[op.slot];
+    Napi::Value keyRef = op.handle != nullptr ? op.handle->keyRef.Value() : op.keyValue;
+    switch (op.type) {
+      case TransactionOp::Type::Set:
+      case TransactionOp::Type::SetIfVersion: {
+        uint64_t version = StoreValueLocked(*op.key, state.entry, keyRef, op.value, op.options, op.bytes);
+        if (state.entry == nullptr) {
+          state.entry = FindEntry(*op.key, op.handle);
+        }
+        results.Set(i, op.type == TransactionOp::Type::Set ? Napi::Boolean::New(env, true)
+                                                          : Napi::Number::New(env, static_cast<double>(version)));
+        break;
+      }
+      case TransactionOp::Type::Delete:
+      case TransactionOp::Type::DeleteIfVersion: {
+        ForgetMissing(*op.key);
+        bool existed = state.entry != nullptr;
+        if (existed) {
+          engine->Erase(*keyspace, state.entry);
+          keyspace->stats.deletes++;
+          state.entry = nullptr;
+        }
+        results.Set(i, Napi::Boolean::New(env, existed || op.type == TransactionOp::Type::DeleteIfVersion));
+        break;
+      }
+      case TransactionOp::Type::Incr: {
+        // Validation ran the same sums, so none of these can overflow
+        if (state.entry != nullptr) {
+          StoreItem& item = state.entry->value;
+          int64_t sum = 0;
+          AddToCounter(item.value.Integer(), op.delta, sum);
+          item.value.SetInteger(sum);
+          item.referenced = true;
+          RecordWrite(item);
+          results.Set(i, item.value.Value(env));
+        } else {
+          int64_t sum = 0;
+          AddToCounter(op.initial, op.delta, sum);
+          Napi::Value value = Napi::Number::New(env, static_cast<double>(sum));
+          StoreValueLocked(*op.key, nullptr, keyRef, value, op.options, op.bytes);
+          state.entry = FindEntry(*op.key, op.handle);
+          results.Set(i, value);
+        }
+        break;
+      }
+    }
+  }
+  engine->EnforceLimits(*keyspace);
+  return results;
+}
+
+// Writes a response with a payload of length bytes into out, from sink's last Reserve
+template <typename Sink>
+static void Respond(Sink& sink, char* out, wire::Type type, const void* payload = nullptr, size_t length = 0) {
+  wire::WriteResponseHeader(out, type, static_cast<uint32_t>(length));
+  if (length > 0) {
+    std::memcpy(out + wire::kResponseHeaderSize, payload, length);
+  }
+  sink.Commit(length);
+}
+
+// Answers a get whose value the sink can never hold; false if it has no room right now
+template <typename Sink>
+static bool RespondTooLarge(Sink& sink) {
+  char* out = sink.Reserve(32);
+  if (out == nullptr) {
+    return false;
+  }
+  Respond(sink, out, wire::Type::Error, "Value too large for the ring", 28);
+  return true;
+}
+
+// A request's value as an entry value; false if it is malformed
+static bool DecodeValue(const wire::Request& request, EntryValue& value) {
+  switch (request.type) {
+    case wire::Type::Integer:
+    case wire::Type::Real:
+      if (request.valueLength != 8) {
+        return false;
+      }
+      if (request.type == wire::Type::Integer) {
+        int64_t integer;
+        std::memcpy(&integer, request.value, sizeof(integer));
+        value.SetInteger(integer);
+      } else {
+        double real;
+        std::memcpy(&real, request.value, sizeof(real));
+        value.SetReal(real);
+      }
+      return true;
+    case wire::Type::Bytes:
+      value.SetBytes(EntryValue::Kind::Bytes, request.value, request.valueLength);
+      return true;
+    case wire::Type::String:
+      value.SetBytes(EntryValue::Kind::String, request.value, request.valueLength);
+      return true;
+    default:
+      return false;
+  }
+}
+
+template <typename Sink>
+bool MemoryStore::ExecuteRequest(Napi::Env env, const wire::Request& request, Sink& sink) {
+  // Every response but a get's fits in this, so it is reserved before anything changes
+  const size_t kShortResponse = 32;
+
+  StoreKey key = (request.flags & wire::kBinaryKey) != 0
+    ? StoreKey::Tagged(StoreKey::Binary, request.key, request.keyLength, engine->hashSeed)
+    : StoreKey::FromString(std::string(request.key, request.keyLength), engine->hashSeed);
+  if (request.op == wire::Op::Get) {
+    return ExecuteGet(env, key, sink);
+  }
+
+  char* out = sink.Reserve(kShortResponse);
+  if (out == nullptr) {
+    return false;
+  }
+
+  SetOptions options = DefaultSetOptions();
+  if (request.ttlMs > 0) {
+    options.isPermanent = false;
+    options.maxAgeMs = request.ttlMs;
+  }
+
+  switch (request.op) {
+    case wire::Op::Set: {
+      EntryValue value;
+      if (!DecodeValue(request, value)) {
+        Respond(sink, out, wire::Type::Error, "Invalid value", 13);
+        break;
+      }
+      size_t valueBytes = request.type == wire::Type::Bytes || request.type == wire::Type::String ? request.valueLength : 8;
+      StoreDecoded(key, std::move(value), valueBytes, options);
+      Respond(sink, out, wire::Type::Ok);
+      break;
+    }
+
+    case wire::Op::Delete: {
+      ForgetMissing(key);
+      Entry* entry = keyspace->table.Find(key);
+      if (entry != nullptr) {
+        engine->Erase(*keyspace, entry);
+        keyspace->stats.deletes++;
+      }
+      Respond(sink, out, entry != nullptr ? wire::Type::Ok : wire::Type::Missing);
+      break;
+    }
+
+    case wire::Op::Incr: {
+      int64_t delta = 1;
+      if (request.type == wire::Type::Integer && request.valueLength == 8) {
+        std::memcpy(&delta, request.value, sizeof(delta));
+      } else if (request.valueLength != 0) {
+        Respond(sink, out, wire::Type::Error, "Invalid value", 13);
+        break;
+      }
+
+      Entry* entry = FindLive(key, nullptr);
+      int64_t sum;
+      if (entry == nullptr) {
+        // A batch built by hand can carry any 64-bit delta; counters stay safe integers
+        if (!AddToCounter(0, delta, sum)) {
+          Respond(sink, out, wire::Type::Error, "Increment would overflow", 24);
+          break;
+        }
+        EntryValue value;
+        value.SetInteger(sum);
+        StoreDecoded(key, std::move(value), 8, options);
+        Respond(sink, out, wire::Type::Integer, &sum, sizeof(sum));
+        break;
+      }
+
+      StoreItem& item = entry->value;
+      if (item.value.GetKind() != EntryValue::Kind::Integer) {
+        Respond(sink, out, wire::Type::Error, "Value is not an integer", 23);
+      } else if (!AddToCounter(item.value.Integer(), delta, sum)) {
+        Respond(sink, out, wire::Type::Error, "Increment would overflow", 24);
+      } else {
+        item.value.SetInteger(sum);
+        item.referenced = true;
+        RecordWrite(item);
+        Respond(sink, out, wire::Type::Integer, &sum, sizeof(sum));
+      }
+      break;
+    }
+
+    case wire::Op::Expire: {
+      Entry* entry = FindLive(key, nullptr);
+      if (entry == nullptr) {
+        Respond(sink, out, wire::Type::Missing);
+        break;
+      }
+      // Only the lifetime changes; the value and its version stay as they are
+      SetOptions lifetime = ItemOptions(entry->value);
+      lifetime.computeMs = entry->value.computeMs;
+      lifetime.isPermanent = request.ttlMs == 0;
+      lifetime.maxAgeMs = request.ttlMs;
+      ApplyOptions(entry->value, lifetime);
+      Respond(sink, out, wire::Type::Ok);
+      break;
+    }
+
+    default:
+      break;
+  }
+  return true;
+}
+
+template <typename Sink>
+bool MemoryStore::ExecuteGet(Napi::Env env, const StoreKey& key, Sink& sink) {
+  Entry* entry = FindLive(key, nullptr);
+  if (entry == nullptr) {
+    char* out = sink.Reserve(0);
+    if (out == nullptr) {
+      return false;
+    }
+    keyspace->stats.misses++;
+    KnownMissing(key);
+    Respond(sink, out, wire::Type::Missing);
+    return true;
+  }
+
+  const EntryValue& value = entry->value.value;
+  char* out;
+  switch (value.GetKind()) {
+    case EntryValue::Kind::Integer:
+    case EntryValue::Kind::Real: {
+      out = sink.Reserve(8);
+      if (out == nullptr) {
+        return false;
+      }
+      if (value.GetKind() == EntryValue::Kind::Integer) {
+        int64_t integer = value.Integer();
+        Respond(sink, out, wire::Type::Integer, &integer, sizeof(integer));
+      } else {
+        double real = value.Real();
+        Respond(sink, out, wire::Type::Real, &real, sizeof(real));
+      }
+      break;
+    }
+
+    case EntryValue::Kind::Bytes:
+    case EntryValue::Kind::String: {
+      const std::string& bytes = value.Bytes();
+      if (!sink.CanFit(bytes.size())) {
+        return RespondTooLarge(sink);
+      }
+      out = sink.Reserve(bytes.size());
+      if (out == nullptr) {
+        return false;
+      }
+      Respond(sink, out, value.GetKind() == EntryValue::Kind::Bytes ? wire::Type::Bytes : wire::Type::String,
+              bytes.data(), bytes.size());
+      break;
+    }
+
+    default: {
+      // Values set from JS: strings and binary data are copied out, anything else can
+      // only be read from JS
+      Napi::HandleScope scope(env);
+      napi_value js = value.Value(env);
+      napi_valuetype type;
+      napi_typeof(env, js, &type);
+      const char* bytes;
+      size_t length = 0;
+      if (type == napi_string) {
+        // Short strings are copied in one call into space that fits them, with room for the
+        // terminator napi_get_value_string_utf8 always writes; longer ones are measured first.
+        // A cut-off copy ends at most 3 bytes short, since characters are never split.
+        const size_t kShortString = 55;
+        out = sink.Reserve(kShortString + 1);
+        if (out != nullptr) {
+          napi_get_value_string_utf8(env, js, out + wire::kResponseHeaderSize, kShortString + 1, &length);
+        }
+        if (out == nullptr || length + 3 >= kShortString) {
+          napi_get_value_string_utf8(env, js, nullptr, 0, &length);
+          if (!sink.CanFit(length + 1)) {
+            return RespondTooLarge(sink);
+          }
+          out = sink.Reserve(length + 1);
+          if (out == nullptr) {
+            return false;
+          }
+          napi_get_value_string_utf8(env, js, out + wire::kResponseHeaderSize, length + 1, &length);
+        }
+        wire::WriteResponseHeader(out, wire::Type::String, static_cast<uint32_t>(length));
+        sink.Commit(length);
+      } else if (type == napi_object && GetTypedArrayBytes(env, js, bytes, length)) {
+        if (!sink.CanFit(length)) {
+          return RespondTooLarge(sink);
+        }
+        out = sink.Reserve(length);
+        if (out == nullptr) {
+          return false;
+        }
+        Respond(sink, out, wire::Type::Bytes, bytes, length);
+      } else {
+        out = sink.Reserve(0);
+        if (out == nullptr) {
+          return false;
+        }
+        Respond(sink, out, wire::Type::Opaque);
+      }
+      break;
+    }
+  }
+
+  entry->value.referenced = true;
+  keyspace->stats.hits++;
+  return true;
+}
+
+void MemoryStore::StoreDecoded(const StoreKey& key, EntryValue&& value, size_t valueBytes, const SetOptions& options) {
+  size_t bytes = sizeof(Entry) + key.Length() + valueBytes;
+  Entry* entry = FindLive(key, nullptr);
+  if (entry != nullptr) {
+    StoreItem& item = entry->value;
+    engine->Account(*keyspace, 0, static_cast<ptrdiff_t>(bytes) - static_cast<ptrdiff_t>(item.bytes));
+    item.value = std::move(value);
+    ApplyOptions(item, options);
+    item.bytes = bytes;
+    item.referenced = true;
+    RecordWrite(item);
+    engine->EnforceLimits(*keyspace);
+    return;
+  }
+
+  // No keyRef: keys() and loaders get one made from the stored key when they need it
+  StoreItem item;
+  item.value = std::move(value);
+  ApplyOptions(item, options);
+  item.bytes = bytes;
+  RecordWrite(item);
+  InsertOrAssign(key, std::move(item));
+}
+
+// Serves a command ring's pending requests in one go, under one lock. Stops early when the
+// response ring is full; the client reads responses and rings the doorbell again.
+Napi::Value MemoryStore::DrainRing(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  const char* data;
+  size_t length;
+  wire::CommandRing ring;
+  if (info.Length() < 1 || !GetTypedArrayBytes(env, info[0], data, length) ||
+      !ring.Attach(const_cast<char*>(data), length)) {
+    Napi::TypeError::New(env, "Expected a command ring").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  struct RingSink {
+    wire::CommandRing& ring;
+    bool CanFit(size_t payloadLength) const { return ring.CanFitResponse(payloadLength); }
+    char* Reserve(size_t payloadLength) { return ring.ReserveResponse(payloadLength); }
+    void Commit(size_t payloadLength) { ring.CommitResponse(payloadLength); }
+  } sink{ring};
+
+  uint32_t served = 0;
+  bool malformed = false;
+  {
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    wire::Request request;
+    for (;;) {
+      size_t size = ring.PeekRequest(request);
+      if (size == SIZE_MAX) {
+        malformed = true;
+        break;
+      }
+      if (size == 0 || !ExecuteRequest(env, request, sink)) {
+        break;
+      }
+      ring.ConsumeRequest(size);
+      served++;
+    }
+    ring.Publish();
+  }
 
-  if (info.Length() < 2) {
-    Napi::TypeError::New(env, "Wrong number of arguments").ThrowAsJavaScriptException();
+  if (malformed) {
+    Napi::Error::New(env, "Malformed request in command ring").ThrowAsJavaScriptException();
     return env.Null();
   }
+  return Napi::Number::New(env, served);
+}
 
-  Napi::Value keyValue = info[0];
-  Napi::Value value = info[1];
-  
-  bool isPermanent = true;
-  uint64_t maxAgeMs = 0;
+// The command ring's protocol over a plain buffer: requests back to back in, responses back
+// to back out. A malformed batch is rejected before any of it runs.
+Napi::Value MemoryStore::ExecuteBatch(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
 
-  if (info.Length() >= 3 && info[2].IsObject()) {
-    Napi::Object options = info[2].As<Napi::Object>();
-    
-    if (options.Has("isPermanent") && options.Get("isPermanent").IsBoolean()) {
-      isPermanent = options.Get("isPermanent").As<Napi::Boolean>().Value();
-    }
-    
-    if (options.Has("maxAgeMs") && options.Get("maxAgeMs").IsNumber()) {
-      maxAgeMs = options.Get("maxAgeMs").As<Napi::Number>().Uint32Value();
+  const char* data;
+  size_t length;
+  if (info.Length() < 1 || !GetTypedArrayBytes(env, info[0], data, length)) {
+    Napi::TypeError::New(env, "Batch must be a Buffer or TypedArray").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  std::vector<wire::Request> requests;
+  for (size_t offset = 0; offset < length;) {
+    wire::Request request;
+    size_t size = wire::ParseRequest(data + offset, length - offset, request);
+    if (size == 0) {
+      Napi::TypeError::New(env, "Malformed request at offset " + std::to_string(offset)).ThrowAsJavaScriptException();
+      return env.Null();
     }
+    requests.push_back(request);
+    offset += size;
   }
 
-  // Determine key
-  std::string keyString;
-  
-  if (keyValue.IsObject() && !keyValue.IsString()) {
-    Napi::Object keyObj = keyValue.As<Napi::Object>();
-    
-    // Check if it has our special property
-    if (keyObj.Has("__keyId") && keyObj.Get("__keyId").IsString()) {
-      std::string keyId = keyObj.Get("__keyId").As<Napi::String>().Utf8Value();
-      
-      // Look up the current key string
-      std::lock_guard<std::mutex> lock(storeMutex);
-      auto it = keyWrappers.find(keyId);
-      if (it != keyWrappers.end()) {
-        keyString = keyId; // Use the ID directly instead of a converted string
-      } else {
-        // Use the ID directly
-        keyString = keyId;
-      }
-    } else {
-      // For other objects, use our SafeGetString
-      keyString = SafeGetString(keyValue);
+  // Responses are sized as they are written; the buffer never runs out of room
+  struct BufferSink {
+    std::string& out;
+    size_t committed;
+    bool CanFit(size_t) const { return true; }
+    char* Reserve(size_t payloadLength) {
+      out.resize(committed + wire::Align(wire::kResponseHeaderSize + payloadLength));
+      return &out[committed];
+    }
+    void Commit(size_t payloadLength) {
+      committed += wire::Align(wire::kResponseHeaderSize + payloadLength);
+      out.resize(committed);
+    }
+  };
+
+  std::string responses;
+  responses.reserve(requests.size() * 16);
+  BufferSink sink{responses, 0};
+  {
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    for (const wire::Request& request : requests) {
+      ExecuteRequest(env, request, sink);
     }
-  } else {
-    // For strings and primitives
-    keyString = SafeGetString(keyValue);
   }
+  return Napi::Buffer<char>::Copy(env, responses.data(), responses.size());
+}
 
-  StoreItem item;
-  item.value = Napi::Persistent(value);
-  item.keyRef = Napi::Persistent(keyValue); // Store reference to original key object
-  item.isPermanent = isPermanent;
-  item.maxAgeMs = maxAgeMs;
+// Jump consistent hash (Lamping and Veach): adding a bucket moves only the keys that
+// belong in it, 1/buckets of them
+static uint32_t JumpHash(uint64_t key, uint32_t buckets) {
+  int64_t bucket = -1;
+  int64_t next = 0;
+  while (next < buckets) {
+    bucket = next;
+    key = key * 2862933555777941757ULL + 1;
+    next = static_cast<int64_t>(static_cast<double>(bucket + 1) *
+                                (static_cast<double>(1LL << 31) / static_cast<double>((key >> 33) + 1)));
+  }
+  return static_cast<uint32_t>(bucket);
+}
+
+Napi::Value MemoryStore::ShardOf(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  // Fixed, unlike each store's seed, so every thread and process agrees on the shard
+  const uint64_t kShardSeed = 0x9e3779b97f4a7c15ULL;
+
+  if (info.Length() < 2 || !info[1].IsNumber()) {
+    Napi::TypeError::New(env, "Key and a shard count are required").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  // Checked before converting, which would wrap counts past 32 bits and truncate fractions
+  double count = info[1].As<Napi::Number>().DoubleValue();
+  if (!(count >= 1 && count < 4294967296.0) || count != std::floor(count)) {
+    Napi::RangeError::New(env, "Shard count must be an integer from 1 to 2^32 - 1").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  uint32_t shards = static_cast<uint32_t>(count);
   
-  if (!isPermanent && maxAgeMs > 0) {
-    item.expiresAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(maxAgeMs);
+  // Hashed in the same encoding stores use, so a string and a Buffer of other bytes never
+  // collide by construction
+  StoreKey key;
+  const char* bytes;
+  size_t length;
+  if (info[0].IsString()) {
+    key = StoreKey::FromString(info[0].As<Napi::String>().Utf8Value(), kShardSeed);
+  } else if (GetTypedArrayBytes(env, info[0], bytes, length)) {
+    key = StoreKey::Tagged(StoreKey::Binary, bytes, length, kShardSeed);
   } else {
-    item.expiresAt = std::chrono::steady_clock::time_point::max();
+    Napi::TypeError::New(env, "Only string and binary keys can be sharded").ThrowAsJavaScriptException();
+    return env.Null();
   }
+  return Napi::Number::New(env, JumpHash(key.hash, shards));
+}
 
-  {
-    std::lock_guard<std::mutex> lock(storeMutex);
-    store.insert_or_assign(keyString, std::move(item));
+// Reads the delta argument of incr() and decr(), 1 if omitted; throws and returns false if
+// it isn't a safe integer
+static bool ReadIntegerDelta(const Napi::CallbackInfo& info, double& delta) {
+  delta = 1;
+  if (info.Length() < 2 || info[1].IsUndefined()) {
+    return true;
   }
+  if (info[1].IsNumber()) {
+    delta = info[1].As<Napi::Number>().DoubleValue();
+    if (std::trunc(delta) == delta && std::fabs(delta) <= 9007199254740991.0) {
+      return true;
+    }
+  }
+  Napi::TypeError::New(info.Env(), "Delta must be an integer").ThrowAsJavaScriptException();
+  return false;
+}
 
-  return Napi::Boolean::New(env, true);
+Napi::Value MemoryStore::Incr(const Napi::CallbackInfo& info) {
+  double delta;
+  if (!ReadIntegerDelta(info, delta)) {
+    return info.Env().Null();
+  }
+  return Increment(info, delta, false);
 }
 
-Napi::Value MemoryStore::Get(const Napi::CallbackInfo& info) {
+Napi::Value MemoryStore::Decr(const Napi::CallbackInfo& info) {
+  double delta;
+  if (!ReadIntegerDelta(info, delta)) {
+    return info.Env().Null();
+  }
+  return Increment(info, -delta, false);
+}
+
+Napi::Value MemoryStore::IncrByFloat(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (info.Length() < 2 || !info[1].IsNumber() || !std::isfinite(info[1].As<Napi::Number>().DoubleValue())) {
+    Napi::TypeError::New(env, "Delta must be a finite number").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  return Increment(info, info[1].As<Napi::Number>().DoubleValue(), true);
+}
+
+Napi::Value MemoryStore::Increment(const Napi::CallbackInfo& info, double delta, bool real) {
   Napi::Env env = info.Env();
 
   if (info.Length() < 1) {
@@ -316,87 +3173,395 @@ Napi::Value MemoryStore::Get(const Napi::CallbackInfo& info) {
     return env.Null();
   }
 
-  Napi::Value keyValue = info[0];
-  
-  // Determine the key string using the same logic as in Set
-  std::string keyString;
+  KeyHandle* handle;
+  StoreKey scratch;
+  const StoreKey* keyPtr = LookupKey(info[0], handle, scratch);
+  if (keyPtr == nullptr) {
+    return env.Null();
+  }
+  const StoreKey& key = *keyPtr;
   
-  if (keyValue.IsObject() && !keyValue.IsString()) {
-    Napi::Object keyObj = keyValue.As<Napi::Object>();
+  {
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    Entry* entry = FindLive(key, handle);
     
-    if (keyObj.Has("__keyId") && keyObj.Get("__keyId").IsString()) {
-      std::string keyId = keyObj.Get("__keyId").As<Napi::String>().Utf8Value();
-      keyString = keyId; // Use the ID directly
-    } else {
-      keyString = SafeGetString(keyValue);
+    // An existing counter keeps its lifetime, so a counter created with maxAgeMs counts
+    // over a fixed window
+    if (entry != nullptr) {
+      StoreItem& item = entry->value;
+      EntryValue::Kind kind = item.value.GetKind();
+      if ((kind != EntryValue::Kind::Integer && kind != EntryValue::Kind::Real) || (!real && kind == EntryValue::Kind::Real)) {
+        Napi::TypeError::New(env, real ? "Value is not a number" : "Value is not an integer")
+          .ThrowAsJavaScriptException();
+        return env.Null();
+      }
+      
+      if (real) {
+        double sum = item.value.Real() + delta;
+        if (!std::isfinite(sum)) {
+          Napi::RangeError::New(env, "Increment would overflow").ThrowAsJavaScriptException();
+          return env.Null();
+        }
+        item.value.SetReal(sum);
+      } else {
+        int64_t sum;
+        if (!AddToCounter(item.value.Integer(), static_cast<int64_t>(delta), sum)) {
+          Napi::RangeError::New(env, "Increment would overflow").ThrowAsJavaScriptException();
+          return env.Null();
+        }
+        item.value.SetInteger(sum);
+      }
+      item.referenced = true;
+      RecordWrite(item);
+      return item.value.Value(env);
     }
-  } else {
-    keyString = SafeGetString(keyValue);
   }
   
-  std::lock_guard<std::mutex> lock(storeMutex);
-  auto it = store.find(keyString);
+  Napi::Value options = info.Length() >= 3 ? info[2] : env.Undefined();
+  double initial = 0;
+  if (options.IsObject() && options.As<Napi::Object>().Get("initial").IsNumber()) {
+    initial = options.As<Napi::Object>().Get("initial").As<Napi::Number>().DoubleValue();
+    if (!real && (std::trunc(initial) != initial || std::fabs(initial) > 9007199254740991.0)) {
+      Napi::TypeError::New(env, "Initial value must be an integer").ThrowAsJavaScriptException();
+      return env.Null();
+    }
+  }
   
-  if (it != store.end()) {
-    // Check if item is expired
-    if (!it->second.isPermanent && it->second.maxAgeMs > 0) {
-      auto now = std::chrono::steady_clock::now();
-      if (now >= it->second.expiresAt) {
-        store.erase(it);
-        return env.Undefined();
-      }
+  // A new counter is summed like an existing one, so it is an integer JS holds exactly
+  double sum = initial + delta;
+  if (!real) {
+    int64_t count;
+    if (!AddToCounter(static_cast<int64_t>(initial), static_cast<int64_t>(delta), count)) {
+      Napi::RangeError::New(env, "Increment would overflow").ThrowAsJavaScriptException();
+      return env.Null();
     }
-    return it->second.value.Value();
+    sum = static_cast<double>(count);
   }
   
-  return env.Undefined();
+  Napi::Value value = Napi::Number::New(env, sum);
+  StoreValue(key, handle, handle != nullptr ? handle->keyRef.Value() : info[0], value, ReadCounterOptions(options));
+  return value;
 }
 
-Napi::Value MemoryStore::Has(const Napi::CallbackInfo& info) {
+Napi::Value MemoryStore::GetOrLoad(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 2 || !info[1].IsFunction()) {
+    Napi::TypeError::New(env, "Key and loader function are required").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  KeyHandle* handle;
+  StoreKey scratch;
+  const StoreKey* keyPtr = LookupKey(info[0], handle, scratch);
+  if (keyPtr == nullptr) {
+    return env.Null();
+  }
+
+  return LoadThrough(env, *keyPtr, handle, handle != nullptr ? handle->keyRef.Value() : info[0],
+                     info[1].As<Napi::Function>(), ReadSetOptions(info.Length() >= 3 ? info[2] : env.Undefined()));
+}
+
+Napi::Value MemoryStore::Load(const Napi::CallbackInfo& info) {
   Napi::Env env = info.Env();
 
   if (info.Length() < 1) {
     Napi::TypeError::New(env, "Key is required").ThrowAsJavaScriptException();
     return env.Null();
   }
+  if (keyspace->batchLoader.IsEmpty()) {
+    Napi::TypeError::New(env, "load() requires a batchLoader").ThrowAsJavaScriptException();
+    return env.Null();
+  }
 
-  Napi::Value keyValue = info[0];
-  
-  // Determine the key string using the same logic as in Set/Get
-  std::string keyString;
-  
-  if (keyValue.IsObject() && !keyValue.IsString()) {
-    Napi::Object keyObj = keyValue.As<Napi::Object>();
-    
-    if (keyObj.Has("__keyId") && keyObj.Get("__keyId").IsString()) {
-      std::string keyId = keyObj.Get("__keyId").As<Napi::String>().Utf8Value();
-      keyString = keyId; // Use the ID directly
+  KeyHandle* handle;
+  StoreKey scratch;
+  const StoreKey* keyPtr = LookupKey(info[0], handle, scratch);
+  if (keyPtr == nullptr) {
+    return env.Null();
+  }
+
+  return LoadThrough(env, *keyPtr, handle, handle != nullptr ? handle->keyRef.Value() : info[0],
+                     Napi::Function(), ReadSetOptions(info.Length() >= 2 ? info[1] : env.Undefined()));
+}
+
+Napi::Value MemoryStore::LoadMany(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1 || !info[0].IsArray()) {
+    Napi::TypeError::New(env, "Keys must be an array").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if (keyspace->batchLoader.IsEmpty()) {
+    Napi::TypeError::New(env, "loadMany() requires a batchLoader").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  SetOptions options = ReadSetOptions(info.Length() >= 2 ? info[1] : env.Undefined());
+  Napi::Array keys = info[0].As<Napi::Array>();
+  Napi::Array promises = Napi::Array::New(env, keys.Length());
+  for (uint32_t i = 0; i < keys.Length(); i++) {
+    Napi::Value keyValue = keys.Get(i);
+    KeyHandle* handle;
+    StoreKey scratch;
+    const StoreKey* keyPtr = LookupKey(keyValue, handle, scratch);
+    if (keyPtr == nullptr) {
+      return env.Null();
+    }
+    promises.Set(i, LoadThrough(env, *keyPtr, handle, handle != nullptr ? handle->keyRef.Value() : keyValue,
+                                Napi::Function(), options));
+  }
+
+  Napi::Object promiseClass = env.Global().Get("Promise").As<Napi::Object>();
+  return promiseClass.Get("all").As<Napi::Function>().Call(promiseClass, {promises});
+}
+
+Napi::Value MemoryStore::LoadThrough(Napi::Env env, const StoreKey& key, KeyHandle* handle, const Napi::Value& keyRef,
+                                     const Napi::Function& loader, const SetOptions& options) {
+  Napi::Value value;
+  Napi::Value staleKeyRef;
+  SetOptions refresh;
+  {
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    Freshness freshness;
+    Entry* entry = FindLive(key, handle, &freshness);
+
+    if (entry == nullptr) {
+      keyspace->stats.misses++;
+
+      // A key known to be missing resolves to undefined without asking the loader again
+      if (KnownMissing(key)) {
+        value = env.Undefined();
+      } else {
+        // Someone is already loading this key; wait for their result
+        auto pending = keyspace->flights.find(key);
+        if (pending != keyspace->flights.end()) {
+          keyspace->stats.coalesced++;
+          return pending->second->promise.Value();
+        }
+      }
     } else {
-      keyString = SafeGetString(keyValue);
+      entry->value.referenced = true;
+      keyspace->stats.hits++;
+      value = entry->value.value.Value(env);
+      if (freshness != Freshness::Fresh) {
+        staleKeyRef = OriginalKey(env, *entry);
+        refresh = ItemOptions(entry->value);
+      }
+    }
+  }
+
+  if (value.IsEmpty()) {
+    return StartLoad(env, key, keyRef, loader, options);
+  }
+  if (!staleKeyRef.IsEmpty()) {
+    LoadInBackground(env, key, staleKeyRef, loader, refresh, true);
+  }
+  Napi::Promise::Deferred deferred = Napi::Promise::Deferred::New(env);
+  deferred.Resolve(value);
+  return deferred.Promise();
+}
+
+Napi::Object MemoryStore::StartLoad(Napi::Env env, const StoreKey& key, const Napi::Value& keyRef,
+                                    const Napi::Function& loader, const SetOptions& options) {
+  auto flight = std::make_shared<Flight>(env);
+  flight->key = key;
+  flight->keyRef.Reset(keyRef);
+  flight->options = options;
+  flight->promise = Napi::Persistent(static_cast<Napi::Object>(flight->deferred.Promise()));
+  flight->owner = Napi::Persistent(Value());
+  keyspace->flights.emplace(key, flight);
+  {
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    keyspace->stats.loads++;
+  }
+
+  // Settling drops the flight's reference, so hold on to the promise for the caller
+  Napi::Object promise = flight->promise.Value();
+
+  if (loader.IsEmpty()) {
+    // The first key queued in a tick schedules the batch loader's call for its end
+    keyspace->batch.push_back(flight);
+    if (keyspace->batch.size() == 1) {
+      Napi::Function dispatch = Napi::Function::New(env, [this](const Napi::CallbackInfo& info) {
+        DispatchBatch(info.Env());
+      }, "dispatchBatch");
+      env.Global().Get("setImmediate").As<Napi::Function>().Call({dispatch});
+    }
+    return promise;
+  }
+
+  // The loader may return a value or a promise, or throw
+  Napi::Value result = loader.Call({keyRef});
+  SettleWhen(env, result, [this, flight](bool loaded, const Napi::Value& value) {
+    SettleFlight(flight, loaded, value);
+  });
+  return promise;
+}
+
+void MemoryStore::DispatchBatch(Napi::Env env) {
+  std::vector<std::shared_ptr<Flight>> batch;
+  batch.swap(keyspace->batch);
+  if (batch.empty()) {
+    return;
+  }
+  {
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    keyspace->stats.batches++;
+  }
+
+  Napi::Array keys = Napi::Array::New(env, batch.size());
+  for (size_t i = 0; i < batch.size(); i++) {
+    keys.Set(static_cast<uint32_t>(i), batch[i]->keyRef.Value());
+  }
+
+  // The batch loader resolves to one value per key, in order. An Error in place of a
+  // value fails only that key's load.
+  Napi::Value result = keyspace->batchLoader.Value().Call({keys});
+  SettleWhen(env, result, [this, batch](bool loaded, const Napi::Value& result) {
+    Napi::Env env = result.Env();
+    Napi::Value error = result;
+    if (loaded && (!result.IsArray() || result.As<Napi::Array>().Length() != batch.size())) {
+      error = Napi::TypeError::New(env, "batchLoader must resolve to an array with one value per key").Value();
+      loaded = false;
+    }
+    if (!loaded) {
+      for (const auto& flight : batch) {
+        SettleFlight(flight, false, error);
+      }
+      return;
+    }
+
+    Napi::Array values = result.As<Napi::Array>();
+    Napi::Function errorClass = env.Global().Get("Error").As<Napi::Function>();
+    for (size_t i = 0; i < batch.size(); i++) {
+      Napi::Value value = values.Get(static_cast<uint32_t>(i));
+      bool failed = value.IsObject() && value.As<Napi::Object>().InstanceOf(errorClass);
+      SettleFlight(batch[i], !failed, value);
+    }
+  });
+}
+
+void MemoryStore::SettleWhen(Napi::Env env, const Napi::Value& result,
+                             std::function<void(bool, const Napi::Value&)> settle) {
+  if (!env.IsExceptionPending()) {
+    Napi::Object promiseClass = env.Global().Get("Promise").As<Napi::Object>();
+    Napi::Object promise = promiseClass.Get("resolve").As<Napi::Function>().Call(promiseClass, {result}).As<Napi::Object>();
+    Napi::Function onResolved = Napi::Function::New(env, [settle](const Napi::CallbackInfo& info) {
+      settle(true, info[0]);
+    });
+    Napi::Function onRejected = Napi::Function::New(env, [settle](const Napi::CallbackInfo& info) {
+      settle(false, info[0]);
+    });
+    promise.Get("then").As<Napi::Function>().Call(promise, {onResolved, onRejected});
+  }
+  if (env.IsExceptionPending()) {
+    settle(false, env.GetAndClearPendingException().Value());
+  }
+}
+
+void MemoryStore::LoadInBackground(Napi::Env env, const StoreKey& key, const Napi::Value& keyRef,
+                                   const Napi::Function& loader, const SetOptions& options, bool stale) {
+  if (keyspace->flights.count(key) > 0) {
+    return;
+  }
+  if (stale) {
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    keyspace->stats.refreshes++;
+  }
+
+  // Nobody waits on these, so a failed load just leaves things as they were instead of
+  // surfacing as an unhandled rejection
+  Napi::Object promise = StartLoad(env, key, keyRef, loader, options);
+  promise.Get("catch").As<Napi::Function>().Call(promise, {Napi::Function::New(env, [](const Napi::CallbackInfo&) {})});
+}
+
+void MemoryStore::SettleFlight(const std::shared_ptr<Flight>& flight, bool loaded, const Napi::Value& result) {
+  auto pending = keyspace->flights.find(flight->key);
+  if (pending == keyspace->flights.end() || pending->second != flight) {
+    return;
+  }
+  keyspace->flights.erase(pending);
+
+  // undefined is what get() returns for a miss, so storing it would only hide the miss.
+  // It can be remembered with a tombstone instead, so the key isn't loaded again for a while.
+  if (loaded && !result.IsUndefined()) {
+    if (flight->options.computeMs == 0) {
+      auto elapsed = std::chrono::steady_clock::now() - flight->started;
+      flight->options.computeMs = static_cast<uint32_t>(std::max<int64_t>(1,
+        std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()));
     }
+    StoreValue(flight->key, nullptr, flight->keyRef.Value(), result, flight->options);
+  } else if (loaded && keyspace->negativeMaxAgeMs > 0) {
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    if (keyspace->table.Find(flight->key) == nullptr) {
+      RememberMissing(flight->key, keyspace->negativeMaxAgeMs);
+    }
+  }
+
+  if (loaded) {
+    flight->deferred.Resolve(result);
   } else {
-    keyString = SafeGetString(keyValue);
+    flight->deferred.Reject(result);
+  }
+  flight->promise.Reset();
+  flight->owner.Reset();
+}
+
+Napi::Value MemoryStore::Has(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Key is required").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  KeyHandle* handle;
+  StoreKey scratch;
+  const StoreKey* keyPtr = LookupKey(info[0], handle, scratch);
+  if (keyPtr == nullptr) {
+    return env.Null();
+  }
+  
+  Entry* entry;
+  Lookup lookup = LookupConcurrent(*keyPtr, handle, entry);
+  if (lookup != Lookup::Unsure) {
+    return Napi::Boolean::New(env, lookup == Lookup::Fresh);
+  }
+  std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+  return Napi::Boolean::New(env, FindLive(*keyPtr, handle) != nullptr);
+}
+
+Napi::Value MemoryStore::Delete(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Key is required").ThrowAsJavaScriptException();
+    return env.Null();
   }
+
+  KeyHandle* handle;
+  StoreKey scratch;
+  const StoreKey* keyPtr = LookupKey(info[0], handle, scratch);
+  if (keyPtr == nullptr) {
+    return env.Null();
+  }
+  const StoreKey& key = *keyPtr;
   
-  std::lock_guard<std::mutex> lock(storeMutex);
-  auto it = store.find(keyString);
+  std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+  ForgetMissing(key);
+  Entry* entry = keyspace->table.Find(key);
   
-  if (it != store.end()) {
-    // Check if item is expired
-    if (!it->second.isPermanent && it->second.maxAgeMs > 0) {
-      auto now = std::chrono::steady_clock::now();
-      if (now >= it->second.expiresAt) {
-        store.erase(it);
-        return Napi::Boolean::New(env, false);
-      }
-    }
+  if (entry != nullptr) {
+    engine->Erase(*keyspace, entry);
+    keyspace->stats.deletes++;
     return Napi::Boolean::New(env, true);
   }
   
   return Napi::Boolean::New(env, false);
 }
 
-Napi::Value MemoryStore::Delete(const Napi::CallbackInfo& info) {
+Napi::Value MemoryStore::DeleteAsync(const Napi::CallbackInfo& info) {
   Napi::Env env = info.Env();
 
   if (info.Length() < 1) {
@@ -404,40 +3569,57 @@ Napi::Value MemoryStore::Delete(const Napi::CallbackInfo& info) {
     return env.Null();
   }
 
-  Napi::Value keyValue = info[0];
-  
-  // Determine the key string using the same logic as other methods
-  std::string keyString;
+  KeyHandle* handle;
+  StoreKey scratch;
+  const StoreKey* keyPtr = LookupKey(info[0], handle, scratch);
+  if (keyPtr == nullptr) {
+    return env.Null();
+  }
+  const StoreKey& key = *keyPtr;
   
-  if (keyValue.IsObject() && !keyValue.IsString()) {
-    Napi::Object keyObj = keyValue.As<Napi::Object>();
-    
-    if (keyObj.Has("__keyId") && keyObj.Get("__keyId").IsString()) {
-      std::string keyId = keyObj.Get("__keyId").As<Napi::String>().Utf8Value();
-      keyString = keyId; // Use the ID directly
-    } else {
-      keyString = SafeGetString(keyValue);
+  // The key is gone as soon as this returns; only releasing the entry is deferred
+  Entry* entry = nullptr;
+  {
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    entry = keyspace->table.Find(key);
+    if (entry != nullptr) {
+      engine->Detach(*keyspace, entry);
+      keyspace->stats.deletes++;
     }
-  } else {
-    keyString = SafeGetString(keyValue);
   }
   
-  std::lock_guard<std::mutex> lock(storeMutex);
-  auto it = store.find(keyString);
-  
-  if (it != store.end()) {
-    store.erase(it);
-    return Napi::Boolean::New(env, true);
+  Napi::Promise::Deferred deferred = Napi::Promise::Deferred::New(env);
+  if (entry == nullptr) {
+    deferred.Resolve(Napi::Boolean::New(env, false));
+    return deferred.Promise();
   }
   
-  return Napi::Boolean::New(env, false);
+  engine->graveyard->Bury(entry, std::make_unique<Napi::Promise::Deferred>(deferred));
+  engine->graveyard->Schedule(env);
+  return deferred.Promise();
 }
 
 Napi::Value MemoryStore::Clear(const Napi::CallbackInfo& info) {
   Napi::Env env = info.Env();
   
-  std::lock_guard<std::mutex> lock(storeMutex);
-  store.clear();
+  // Swap in an empty table and release the old entries over the next ticks
+  auto detached = std::make_unique<StoreTable>();
+  detached->Reserve(keyspace->expectedSize);
+  // Tombstones hold no references, so they can be freed right here, outside the lock
+  TombstoneTable tombstones;
+  {
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    keyspace->missing.Swap(tombstones);
+    engine->Account(*keyspace, -static_cast<ptrdiff_t>(keyspace->table.Size()), -static_cast<ptrdiff_t>(keyspace->bytes));
+    keyspace->table.Swap(*detached);
+    keyspace->keyPrefixes.Clear();
+    keyspace->generation++;
+  }
+  
+  if (detached->Size() > 0) {
+    engine->graveyard->Bury(std::move(detached));
+    engine->graveyard->Schedule(env);
+  }
   
   return Napi::Boolean::New(env, true);
 }
@@ -445,30 +3627,42 @@ Napi::Value MemoryStore::Clear(const Napi::CallbackInfo& info) {
 Napi::Value MemoryStore::Size(const Napi::CallbackInfo& info) {
   Napi::Env env = info.Env();
   
-  std::lock_guard<std::mutex> lock(storeMutex);
-  return Napi::Number::New(env, static_cast<uint32_t>(store.size()));
+  std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+  return Napi::Number::New(env, static_cast<uint32_t>(keyspace->table.Size()));
 }
 
 Napi::Value MemoryStore::Keys(const Napi::CallbackInfo& info) {
   Napi::Env env = info.Env();
   
   std::vector<std::string> validKeys;
+  std::vector<Napi::Value> taggedKeys;
   auto now = std::chrono::steady_clock::now();
   
   {
-    std::lock_guard<std::mutex> lock(storeMutex);
-    for (const auto& pair : store) {
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    keyspace->table.ForEach([&](const Entry& entry) {
       // Check if item is not expired
-      if (pair.second.isPermanent || pair.second.maxAgeMs == 0 || now < pair.second.expiresAt) {
-        validKeys.push_back(pair.first);
+      if (entry.value.isPermanent || entry.value.maxAgeMs == 0 || now < entry.value.expiresAt) {
+        if (entry.key.IsKind(StoreKey::Binary)) {
+          // A copy of the stored bytes, since the original buffer may have changed since
+          taggedKeys.push_back(Napi::Buffer<char>::Copy(env, entry.key.str.data() + 2, entry.key.str.size() - 2));
+        } else if (entry.key.IsTagged()) {
+          // Identity and structural keys have no string form, so report the original key
+          taggedKeys.push_back(entry.value.keyRef.Value());
+        } else {
+          validKeys.push_back(entry.key.ToString());
+        }
       }
-    }
+    });
   }
   
-  Napi::Array keysArray = Napi::Array::New(env, validKeys.size());
+  Napi::Array keysArray = Napi::Array::New(env, validKeys.size() + taggedKeys.size());
   for (size_t i = 0; i < validKeys.size(); i++) {
     keysArray.Set(i, Napi::String::New(env, validKeys[i]));
   }
+  for (size_t i = 0; i < taggedKeys.size(); i++) {
+    keysArray.Set(validKeys.size() + i, taggedKeys[i]);
+  }
   
   return keysArray;
 }
@@ -481,25 +3675,25 @@ Napi::Value MemoryStore::GetKeys(const Napi::CallbackInfo& info) {
   // First count valid keys to pre-size the array
   size_t validKeyCount = 0;
   {
-    std::lock_guard<std::mutex> lock(storeMutex);
-    for (const auto& pair : store) {
-      if (pair.second.isPermanent || pair.second.maxAgeMs == 0 || now < pair.second.expiresAt) {
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    keyspace->table.ForEach([&](const Entry& entry) {
+      if (entry.value.isPermanent || entry.value.maxAgeMs == 0 || now < entry.value.expiresAt) {
         validKeyCount++;
       }
-    }
+    });
   }
   
   Napi::Array keysArray = Napi::Array::New(env, validKeyCount);
   
   // Now populate the array directly, without using an intermediate vector
   {
-    std::lock_guard<std::mutex> lock(storeMutex);
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
     size_t index = 0;
-    for (const auto& pair : store) {
-      if (pair.second.isPermanent || pair.second.maxAgeMs == 0 || now < pair.second.expiresAt) {
-        keysArray.Set(index++, pair.second.keyRef.Value());
+    keyspace->table.ForEach([&](const Entry& entry) {
+      if (entry.value.isPermanent || entry.value.maxAgeMs == 0 || now < entry.value.expiresAt) {
+        keysArray.Set(index++, OriginalKey(env, entry));
       }
-    }
+    });
   }
   
   return keysArray;
@@ -513,25 +3707,25 @@ Napi::Value MemoryStore::All(const Napi::CallbackInfo& info) {
   // First count valid items to pre-size the array
   size_t validItemCount = 0;
   {
-    std::lock_guard<std::mutex> lock(storeMutex);
-    for (const auto& pair : store) {
-      if (pair.second.isPermanent || pair.second.maxAgeMs == 0 || now < pair.second.expiresAt) {
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    keyspace->table.ForEach([&](const Entry& entry) {
+      if (entry.value.isPermanent || entry.value.maxAgeMs == 0 || now < entry.value.expiresAt) {
         validItemCount++;
       }
-    }
+    });
   }
   
   Napi::Array valuesArray = Napi::Array::New(env, validItemCount);
   
   // Populate the array with all stored values
   {
-    std::lock_guard<std::mutex> lock(storeMutex);
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
     size_t index = 0;
-    for (const auto& pair : store) {
-      if (pair.second.isPermanent || pair.second.maxAgeMs == 0 || now < pair.second.expiresAt) {
-        valuesArray.Set(index++, pair.second.value.Value());
+    keyspace->table.ForEach([&](const Entry& entry) {
+      if (entry.value.isPermanent || entry.value.maxAgeMs == 0 || now < entry.value.expiresAt) {
+        valuesArray.Set(index++, entry.value.value.Value(env));
       }
-    }
+    });
   }
   
   return valuesArray;
@@ -541,11 +3735,111 @@ Napi::Value MemoryStore::StartCleanupTask(const Napi::CallbackInfo& info) {
   Napi::Env env = info.Env();
   
   if (info.Length() > 0 && info[0].IsNumber()) {
-    cleanupIntervalMs = info[0].As<Napi::Number>().Uint32Value();
+    engine->cleanupIntervalMs = info[0].As<Napi::Number>().Uint32Value();
+  }
+  
+  return Napi::Boolean::New(env, engine->StartCleanup());
+}
+
+Napi::Value MemoryStore::StopCleanupTask(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  return Napi::Boolean::New(env, engine->StopCleanup());
+}
+
+Napi::Value MemoryStore::Namespace(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1 || !info[0].IsString() || info[0].As<Napi::String>().Utf8Value().empty()) {
+    Napi::TypeError::New(env, "Namespace name must be a non-empty string").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  
+  // Namespaces are keyspaces of the engine, named apart from the store's own ""
+  ViewInit init{engine, nullptr};
+  {
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    init.keyspace = engine->GetKeyspace(info[0].As<Napi::String>().Utf8Value());
+  }
+  
+  AddonData* data = env.GetInstanceData<AddonData>();
+  data->pendingView = &init;
+  Napi::Object view = data->memoryStoreConstructor.New({});
+  data->pendingView = nullptr;
+  if (view.IsEmpty()) {
+    return env.Null();
   }
   
+  if (info.Length() > 1 && info[1].IsObject()) {
+    Napi::Object options = info[1].As<Napi::Object>();
+    MemoryStore::Unwrap(view)->ApplyKeyspaceOptions(options);
+    
+    // Quotas apply at once, evicting whatever a lowered quota no longer fits
+    Limits quota = init.keyspace->quota;
+    if (ReadLimits(options, quota)) {
+      std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+      init.keyspace->quota = quota;
+      engine->EnforceLimits(*init.keyspace);
+    }
+  }
+  return view;
+}
+
+Napi::Value MemoryStore::GetStats(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  
+  Stats stats;
+  size_t size;
+  size_t bytes;
+  size_t missing;
+  {
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    stats = keyspace->stats;
+    size = keyspace->table.Size();
+    bytes = keyspace->bytes;
+    missing = keyspace->missing.Size();
+  }
+  
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("size", Napi::Number::New(env, static_cast<double>(size)));
+  result.Set("hits", Napi::Number::New(env, static_cast<double>(stats.hits)));
+  result.Set("misses", Napi::Number::New(env, static_cast<double>(stats.misses)));
+  result.Set("sets", Napi::Number::New(env, static_cast<double>(stats.sets)));
+  result.Set("deletes", Napi::Number::New(env, static_cast<double>(stats.deletes)));
+  result.Set("expired", Napi::Number::New(env, static_cast<double>(stats.expired)));
+  result.Set("evicted", Napi::Number::New(env, static_cast<double>(stats.evicted)));
+  result.Set("bytes", Napi::Number::New(env, static_cast<double>(bytes)));
+  result.Set("loads", Napi::Number::New(env, static_cast<double>(stats.loads)));
+  result.Set("coalesced", Napi::Number::New(env, static_cast<double>(stats.coalesced)));
+  result.Set("refreshes", Napi::Number::New(env, static_cast<double>(stats.refreshes)));
+  result.Set("earlyExpired", Napi::Number::New(env, static_cast<double>(stats.earlyExpired)));
+  result.Set("batches", Napi::Number::New(env, static_cast<double>(stats.batches)));
+  result.Set("negativeHits", Napi::Number::New(env, static_cast<double>(stats.negativeHits)));
+  result.Set("unchanged", Napi::Number::New(env, static_cast<double>(stats.unchanged)));
+  result.Set("missing", Napi::Number::New(env, static_cast<double>(missing)));
+  return result;
+}
+
+// The lock belongs to the engine, so every namespace reports the same numbers
+Napi::Value MemoryStore::LockStats(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+
+  AdaptiveMutex::Stats stats;
+  {
+    std::lock_guard<AdaptiveMutex> lock(engine->mutex);
+    stats = engine->mutex.GetStats();
+  }
+
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("acquisitions", Napi::Number::New(env, static_cast<double>(stats.acquisitions)));
+  result.Set("contended", Napi::Number::New(env, static_cast<double>(stats.contended)));
+  result.Set("parked", Napi::Number::New(env, static_cast<double>(stats.parked)));
+  result.Set("waitNs", Napi::Number::New(env, static_cast<double>(stats.waitNs)));
+  return result;
+}
+
+bool MemoryStore::Engine::StartCleanup() {
   if (!stopCleanup) {
-    return Napi::Boolean::New(env, false); // Already running
+    return false; // Already running
   }
   
   stopCleanup = false;
@@ -554,16 +3848,13 @@ Napi::Value MemoryStore::StartCleanupTask(const Napi::CallbackInfo& info) {
     cleanupThread.join();
   }
   
-  cleanupThread = std::thread(&MemoryStore::CleanupWorker, this);
-  
-  return Napi::Boolean::New(env, true);
+  cleanupThread = std::thread(&Engine::CleanupWorker, this);
+  return true;
 }
 
-Napi::Value MemoryStore::StopCleanupTask(const Napi::CallbackInfo& info) {
-  Napi::Env env = info.Env();
-  
+bool MemoryStore::Engine::StopCleanup() {
   if (stopCleanup) {
-    return Napi::Boolean::New(env, false); // Already stopped
+    return false; // Already stopped
   }
   
   stopCleanup = true;
@@ -572,28 +3863,60 @@ Napi::Value MemoryStore::StopCleanupTask(const Napi::CallbackInfo& info) {
   if (cleanupThread.joinable()) {
     cleanupThread.join();
   }
-  
-  return Napi::Boolean::New(env, true);
+  return true;
 }
 
-void MemoryStore::CleanupExpiredItems() {
+// One sweep covers every keyspace, so namespaces don't each need a thread of their own
+void MemoryStore::Engine::CleanupExpiredItems() {
   auto now = std::chrono::steady_clock::now();
   
-  std::lock_guard<std::mutex> lock(storeMutex);
-  for (auto it = store.begin(); it != store.end();) {
-    if (!it->second.isPermanent && it->second.maxAgeMs > 0 && now >= it->second.expiresAt) {
-      it = store.erase(it);
-    } else {
-      ++it;
+  std::vector<Entry*> expired;
+  {
+    std::lock_guard<AdaptiveMutex> lock(mutex);
+    for (auto& pair : keyspaces) {
+      Keyspace& keyspace = *pair.second;
+      uint64_t count = 0;
+      // Lock-free lookups that overlap the changes below won't trust a miss
+      uint64_t sequence = keyspace.sequence.load(std::memory_order_relaxed);
+      keyspace.sequence.store(sequence + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      Entry* entries = keyspace.table.UnlinkIf([&](Entry& entry) {
+        if (entry.value.Expired(now)) {
+          Account(keyspace, -1, -static_cast<ptrdiff_t>(entry.value.bytes));
+          keyspace.keyPrefixes.ReleaseLater(entry.key);
+          count++;
+          return true;
+        }
+        return false;
+      });
+      keyspace.missing.EraseIf([&](TombstoneTable::Node& tombstone) {
+        return now >= tombstone.value.expiresAt;
+      });
+      keyspace.sequence.store(sequence + 2, std::memory_order_release);
+      if (entries != nullptr) {
+        keyspace.generation++;
+        keyspace.stats.expired += count;
+        expired.push_back(entries);
+      }
+    }
+  }
+  
+  // This runs on the cleanup thread, where references can't be released. The graveyard
+  // frees the entries on the JS thread, which is also the only thread that reads without
+  // the lock, so no lock-free lookup can still be on one by then.
+  if (!expired.empty()) {
+    for (Entry* entries : expired) {
+      graveyard->Bury(entries);
     }
+    graveyard->Signal();
   }
 }
 
-void MemoryStore::CleanupWorker() {
+void MemoryStore::Engine::CleanupWorker() {
   while (!stopCleanup) {
     CleanupExpiredItems();
     
-    std::unique_lock<std::mutex> lock(storeMutex);
+    std::unique_lock<AdaptiveMutex> lock(mutex);
     cleanupCV.wait_for(lock, std::chrono::milliseconds(cleanupIntervalMs), [this] { return stopCleanup.load(); });
   }
 }
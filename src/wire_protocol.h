@@ -0,0 +1,226 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "atomic_access.h"
+
+// Binary encoding of store operations, so a batch of them can be handed over in one call
+// instead of one N-API call (and a handful of JS values) each.
+//
+// A request is a 16-byte header followed by the key bytes and the value bytes, padded to a
+// multiple of 8 bytes:
+//
+//   0  u8   op           Op
+//   1  u8   flags        kBinaryKey: the key is raw bytes rather than a UTF-8 string
+//   2  u8   value type   Type::Integer, Real, Bytes or String; 0 if there is no value
+//   3  u8   reserved
+//   4  u32  key length
+//   8  u32  value length
+//   12 u32  ttl          Milliseconds; 0 means the keyspace default (set, incr) or no
+//                        expiry (expire)
+//
+// A response is an 8-byte header, a type and a payload length, followed by the payload,
+// also padded to a multiple of 8. Integers and reals are 8 bytes. Everything is
+// little-endian, like every platform Node runs on.
+namespace wire {
+
+enum class Op : uint8_t {
+  Get = 1,
+  Set = 2,
+  Delete = 3,
+  Incr = 4,   // Value is an optional Integer delta, 1 if absent
+  Expire = 5
+};
+
+enum class Type : uint8_t {
+  Wrap = 0,     // Ring only: the next record starts at the beginning of the ring
+  Integer = 1,
+  Real = 2,
+  Bytes = 3,
+  String = 4,
+  Missing = 5,  // No such key, for get, delete and expire
+  Ok = 6,
+  Opaque = 7,   // The value is a JS object or other value with no binary form
+  Error = 8     // Payload is a UTF-8 message
+};
+
+const uint8_t kBinaryKey = 1;
+
+const size_t kRequestHeaderSize = 16;
+const size_t kResponseHeaderSize = 8;
+
+inline size_t Align(size_t size) {
+  return (size + 7) & ~static_cast<size_t>(7);
+}
+
+struct Request {
+  Op op;
+  uint8_t flags;
+  Type type;
+  const char* key;
+  uint32_t keyLength;
+  const char* value;
+  uint32_t valueLength;
+  uint32_t ttlMs;
+};
+
+inline uint32_t ReadU32(const char* data) {
+  uint32_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+// Parses the request at data; returns its padded size, or 0 if it is malformed or runs
+// past available
+inline size_t ParseRequest(const char* data, size_t available, Request& request) {
+  if (available < kRequestHeaderSize) {
+    return 0;
+  }
+  uint8_t op = static_cast<uint8_t>(data[0]);
+  uint8_t type = static_cast<uint8_t>(data[2]);
+  if (op < static_cast<uint8_t>(Op::Get) || op > static_cast<uint8_t>(Op::Expire) ||
+      type > static_cast<uint8_t>(Type::String)) {
+    return 0;
+  }
+  request.op = static_cast<Op>(op);
+  request.flags = static_cast<uint8_t>(data[1]);
+  request.type = static_cast<Type>(type);
+  request.keyLength = ReadU32(data + 4);
+  request.valueLength = ReadU32(data + 8);
+  request.ttlMs = ReadU32(data + 12);
+
+  size_t size = Align(kRequestHeaderSize + static_cast<size_t>(request.keyLength) + request.valueLength);
+  if (size > available) {
+    return 0;
+  }
+  request.key = data + kRequestHeaderSize;
+  request.value = request.key + request.keyLength;
+  return size;
+}
+
+// Writes a response header and zeroes the padding after the payload
+inline void WriteResponseHeader(char* out, Type type, uint32_t length) {
+  std::memset(out, 0, kResponseHeaderSize);
+  out[0] = static_cast<char>(type);
+  std::memcpy(out + 4, &length, sizeof(length));
+  size_t end = kResponseHeaderSize + length;
+  std::memset(out + end, 0, Align(end) - end);
+}
+
+// A request ring and a response ring in one SharedArrayBuffer, after a header of 32-bit
+// fields. Each ring has a single producer and a single consumer: a client writes requests
+// and reads responses, the store's thread does the opposite. Positions are byte offsets
+// into the ring and a ring is empty when head equals tail, so a producer always leaves at
+// least 8 bytes free. A record that doesn't fit before the end of the ring is preceded by
+// a Wrap marker and starts over at offset 0.
+class CommandRing {
+public:
+  enum Field {
+    RequestHead,       // Written by the client
+    RequestTail,       // Written by the store
+    ResponseHead,      // Written by the store
+    ResponseTail,      // Written by the client
+    RequestCapacity,
+    ResponseCapacity,
+    Doorbell,          // Bumped by the client when it wants requests served
+    Closed             // Set once nothing serves the ring any more; only the client reads it
+  };
+
+  static const size_t kHeaderSize = 32;
+  static const size_t kMinCapacity = 256;
+
+  // false if data doesn't hold a ring
+  bool Attach(char* data, size_t length) {
+    if (length < kHeaderSize || reinterpret_cast<uintptr_t>(data) % 8 != 0) {
+      return false;
+    }
+    header = reinterpret_cast<uint32_t*>(data);
+    requestCapacity = header[RequestCapacity];
+    responseCapacity = header[ResponseCapacity];
+    if (requestCapacity % 8 != 0 || responseCapacity % 8 != 0 || requestCapacity < kMinCapacity ||
+        responseCapacity < kMinCapacity ||
+        kHeaderSize + static_cast<size_t>(requestCapacity) + responseCapacity > length) {
+      return false;
+    }
+    requests = data + kHeaderSize;
+    responses = requests + requestCapacity;
+
+    requestHead = atomic_access::LoadAcquire(header[RequestHead]);
+    requestTail = header[RequestTail];
+    responseHead = header[ResponseHead];
+    responseTail = atomic_access::LoadAcquire(header[ResponseTail]);
+    return requestHead < requestCapacity && requestTail < requestCapacity && requestHead % 8 == 0 &&
+           requestTail % 8 == 0 && responseHead < responseCapacity && responseTail < responseCapacity &&
+           responseHead % 8 == 0 && responseTail % 8 == 0;
+  }
+
+  // The next pending request, without consuming it. Returns its size, 0 if there is none,
+  // or SIZE_MAX if it is malformed.
+  size_t PeekRequest(Request& request) {
+    if (requestTail != requestHead && requests[requestTail] == static_cast<char>(Type::Wrap)) {
+      requestTail = 0;
+    }
+    if (requestTail == requestHead) {
+      return 0;
+    }
+    size_t available = (requestHead > requestTail ? requestHead : requestCapacity) - requestTail;
+    size_t size = ParseRequest(requests + requestTail, available, request);
+    return size != 0 ? size : SIZE_MAX;
+  }
+
+  void ConsumeRequest(size_t size) {
+    requestTail = static_cast<uint32_t>((requestTail + size) % requestCapacity);
+  }
+
+  // Whether a response with a payload of length bytes can ever be written. Once the client
+  // has read everything, the free space on one side of the head is at least half the
+  // ring, so anything up to that size eventually fits; anything larger may never.
+  bool CanFitResponse(size_t length) const {
+    return Align(kResponseHeaderSize + length) + 8 <= responseCapacity / 2;
+  }
+
+  // Space for a response with a payload of length bytes, or nullptr if the client hasn't
+  // read enough responses yet
+  char* ReserveResponse(size_t length) {
+    size_t size = Align(kResponseHeaderSize + length);
+    if (responseHead >= responseTail) {
+      size_t end = responseCapacity - responseHead;
+      if (size < end || (size == end && responseTail != 0)) {
+        return responses + responseHead;
+      }
+      if (size >= responseTail) {
+        return nullptr;
+      }
+      responses[responseHead] = static_cast<char>(Type::Wrap);
+      responseHead = 0;
+      return responses;
+    }
+    return responseHead + size < responseTail ? responses + responseHead : nullptr;
+  }
+
+  // Commits the response last reserved
+  void CommitResponse(size_t length) {
+    responseHead = static_cast<uint32_t>((responseHead + Align(kResponseHeaderSize + length)) % responseCapacity);
+  }
+
+  // Hands consumed requests and committed responses to the client
+  void Publish() {
+    atomic_access::StoreRelease(header[RequestTail], requestTail);
+    atomic_access::StoreRelease(header[ResponseHead], responseHead);
+  }
+
+private:
+  uint32_t* header = nullptr;
+  char* requests = nullptr;
+  char* responses = nullptr;
+  uint32_t requestCapacity = 0;
+  uint32_t responseCapacity = 0;
+  uint32_t requestHead = 0;
+  uint32_t requestTail = 0;
+  uint32_t responseHead = 0;
+  uint32_t responseTail = 0;
+};
+
+}  // namespace wire
@@ -1,3 +1,4 @@
+const assert = require('assert');
 const store = require('./test-export');
 
 // Create mutable keys
@@ -117,4 +118,183 @@ myInstance.greet();
 // calling saved instance of class
 store.set(complexKey, myInstance);
 let myInstance2 = store.get(complexKey);
-myInstance2.greet('Nice person');
\ No newline at end of file
+myInstance2.greet('Nice person');
+
+// Precompiled handle for a hot key
+const flagHandle = store.handle('feature:new-checkout');
+store.set(flagHandle, true);
+console.log('\nFlag via handle:', store.get(flagHandle), store.has('feature:new-checkout'));
+
+// Object keys by identity instead of JSON.stringify
+const MemoryStore = require('./index');
+const identityStore = new MemoryStore({ objectKeys: 'identity', autoStartCleanup: false });
+const tenantA = { tenant: 1 };
+identityStore.set(tenantA, 'tenant A data');
+console.log('Identity key:', identityStore.get(tenantA), identityStore.get({ tenant: 1 }));
+
+// Deleting without releasing the value during the call
+store.set('report:2024', new Array(1000).fill('row'));
+store.deleteAsync('report:2024').then((released) => {
+    console.log('Released report:', released, store.has('report:2024'));
+});
+
+// Isolated namespaces sharing one store
+const sessions = identityStore.namespace('sessions', { defaultMaxAgeMs: 60000 });
+sessions.set('user:1', 'session data');
+console.log('Namespace:', sessions.get('user:1'), identityStore.get('user:1'), sessions.stats());
+
+// Per-namespace quota: a noisy tenant only evicts its own entries
+const noisy = identityStore.namespace('noisy', { maxEntries: 2 });
+['a', 'b', 'c'].forEach((id) => noisy.set(id, id));
+console.log('Quota:', noisy.size(), noisy.stats().evicted, sessions.get('user:1'));
+
+// Without the cleanup task, an expired entry is still reclaimed before a live one is evicted
+const otp = identityStore.namespace('otp', { maxEntries: 2 });
+otp.set('device', 'trusted');
+otp.set('code', 123456, { isPermanent: false, maxAgeMs: 1 });
+setTimeout(() => {
+    otp.set('code:new', 654321);
+    console.log('Expired first:', otp.get('device'), otp.stats().expired, otp.stats().evicted);
+}, 5);
+
+// Concurrent misses share one load
+let profileLoads = 0;
+const loadProfile = async (key) => { profileLoads++; return { id: key, name: 'Alice' }; };
+Promise.all([1, 2, 3].map(() => store.getOrLoad('profile:1', loadProfile))).then((profiles) => {
+    console.log('Loaded once:', profileLoads, profiles[0] === profiles[2]);
+});
+
+// Stale-while-revalidate: reads keep getting the old rates while they are reloaded
+const rates = new MemoryStore({ autoStartCleanup: false, loader: async () => ({ eur: 1.09 }) });
+rates.set('rates', { eur: 1.08 }, { staleAfterMs: 1 });
+setTimeout(() => {
+    console.log('Stale rates:', rates.get('rates'));
+    setTimeout(() => console.log('Refreshed rates:', rates.get('rates')), 10);
+}, 5);
+
+// Entries written together expire spread over the last 20% of their lifetime
+const batch = new MemoryStore({ autoStartCleanup: false, ttlJitter: 0.2 });
+for (let i = 0; i < 100; i++) batch.set(`item:${i}`, i, { isPermanent: false, maxAgeMs: 1000 });
+console.log('Jittered batch:', batch.size());
+
+// Read-through with a batch loader: misses from one tick become one origin request
+const users = new MemoryStore({ autoStartCleanup: false, negativeMaxAgeMs: 30000,
+    batchLoader: async (ids) => ids.map((id) => (id === 'u404' ? undefined : { id })) });
+users.loadMany(['u1', 'u2', 'u404']).then((found) => {
+    console.log('Batch loaded:', found, users.stats().batches);
+});
+
+// Known-missing keys are cheap tombstones, distinct from keys that aren't cached
+store.setMissing('user:deleted', 60000);
+console.log('Missing:', store.get('user:deleted', null), store.get('user:unknown', null));
+
+// Read-modify-write with a single lookup
+store.update('visits', (count) => (count || 0) + 1);
+console.log('Visits:', store.update('visits', (count) => count + 1));
+
+// Fixed-window rate limiting with a native counter
+for (let i = 0; i < 3; i++) store.incr('rate:client-1', 1, { maxAgeMs: 60000 });
+console.log('Requests this minute:', store.get('rate:client-1'));
+
+// Counters stay exact: an increment past Number.MAX_SAFE_INTEGER throws instead of rounding
+store.incr('ids:next', 1, { initial: Number.MAX_SAFE_INTEGER - 2 });
+try {
+    store.incr('ids:next', 2);
+} catch (e) {
+    console.log('Counter limit:', store.get('ids:next') === Number.MAX_SAFE_INTEGER - 1, store.incr('ids:next'), e.message);
+}
+
+// Optimistic concurrency: write back only if nobody else wrote in between
+store.set('settings', { theme: 'dark' });
+const { value: settings, version } = store.getWithVersion('settings');
+const saved = store.setIfVersion('settings', { ...settings, theme: 'light' }, version);
+console.log('Saved:', saved !== false, 'Stale write:', store.setIfVersion('settings', settings, version));
+assert.deepStrictEqual(store.get('settings'), { theme: 'light' });
+assert.strictEqual(store.deleteIfVersion('settings', version), false);
+assert.strictEqual(store.has('settings'), true);
+
+// A write that takes a namespace past its quota can evict the entry it just wrote
+const drafts = identityStore.namespace('drafts', { maxBytes: 300 });
+drafts.set('draft:1', 'x');
+const draftVersion = drafts.getWithVersion('draft:1').version;
+console.log('Over quota:', drafts.setIfVersion('draft:1', 'y'.repeat(2000), draftVersion) > draftVersion, drafts.has('draft:1'));
+
+// Conditional reads: only hand back config that changed since the caller's copy
+const config = store.getWithVersion('settings');
+console.log('Config unchanged:', store.getIfChanged('settings', config.version) === MemoryStore.UNCHANGED);
+
+// A value and the index pointing at it change together or not at all
+console.log('Transaction:', store.transaction([
+    { op: 'set', key: 'order:7', value: { total: 42 } },
+    { op: 'set', key: 'orders-by-user:alice', value: ['order:7'] },
+    { op: 'incr', key: 'orders:count' },
+]));
+
+// A failed version check applies none of the transaction, not even the operations before it
+assert.strictEqual(store.transaction([
+    { op: 'set', key: 'order:8', value: { total: 7 } },
+    { op: 'incr', key: 'orders:count' },
+    { op: 'deleteIfVersion', key: 'order:7', version: 0 },
+]), false);
+assert.strictEqual(store.has('order:8'), false);
+assert.strictEqual(store.get('orders:count'), 1);
+assert.deepStrictEqual(store.get('order:7'), { total: 42 });
+
+// Each worker thread owns one shard of the keys; route operations to the owner
+console.log('Owner of user:42 among 4 workers:', MemoryStore.shardOf('user:42', 4));
+const shards = MemoryStore.createShards(2, { autoStartCleanup: false });
+const sharded = shards.connect();
+sharded.set('user:42', 'Alice');
+sharded.incr('logins:user:42');
+sharded.get('user:42');
+sharded.readAsync().then((results) => {
+    console.log('Sharded:', results);
+    return shards.close();
+});
+
+// How often the store's lock was held up by the cleanup thread
+const { acquisitions, contended } = store.lockStats();
+console.log('Lock contended:', contended, 'of', acquisitions);
+
+// Pipelining through a command ring: one native call serves the whole batch
+const ring = MemoryStore.createRing();
+const pipeline = new MemoryStore.RingClient(ring);
+pipeline.set('page:/home', '<h1>Home</h1>');
+pipeline.incr('page:/home:views');
+pipeline.get('page:/home');
+store.drainRing(ring);
+console.log('Pipelined:', pipeline.results());
+
+// A small ring: records wrap around its end, and a get too large for it is answered with an Error
+const small = MemoryStore.createRing({ requestBytes: 256, responseBytes: 256 });
+const smallClient = new MemoryStore.RingClient(small);
+store.set('ring:big', 'x'.repeat(200));
+smallClient.get('ring:big');
+store.drainRing(small);
+const [tooLarge] = smallClient.results();
+assert.ok(tooLarge instanceof Error && /too large/.test(tooLarge.message));
+for (let round = 0; round < 20; round++) {
+    const value = `${round}`.padEnd(50, '.');
+    smallClient.set('ring:k', value);
+    smallClient.get('ring:k');
+    store.drainRing(small);
+    assert.deepStrictEqual(smallClient.results(), [true, value]);
+}
+// Responses that don't all fit are served by later drains, in order, once earlier ones are read
+for (let i = 0; i < 4; i++) smallClient.get('ring:k');
+assert.ok(store.drainRing(small) < 4);
+const answered = smallClient.results();
+while (answered.length < 4) {
+    store.drainRing(small);
+    answered.push(...smallClient.results());
+}
+assert.deepStrictEqual(answered, new Array(4).fill('19'.padEnd(50, '.')));
+
+// A forwarded pipeline runs as one packed buffer in and one out
+const ops = [
+    { op: 'set', key: 'cart:9', value: 'sku-1,sku-2' },
+    { op: 'incr', key: 'cart:9:updates' },
+    { op: 'get', key: 'cart:9' },
+    { op: 'delete', key: 'cart:unknown' },
+];
+console.log('Batch:', MemoryStore.decodeBatch(store.executeBatch(MemoryStore.encodeBatch(ops)), ops));